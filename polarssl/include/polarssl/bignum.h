@@ -598,6 +598,27 @@ int mpi_mod_int( t_uint *r, const mpi *A, t_sint b );
  */
 int mpi_exp_mod( mpi *X, const mpi *A, const mpi *E, const mpi *N, mpi *_RR );
 
+/**
+ * \brief          Fixed-window exponentiation: X = A^E mod N
+ *
+ *                 For N of 1024-bit or 2048-bit, the sequence of
+ *                 operations and memory access don't depend on E.
+ *                 For other size, this is same as mpi_exp_mod.
+ *
+ * \param X        Destination MPI
+ * \param A        Left-hand MPI
+ * \param E        Exponent MPI
+ * \param N        Modular MPI
+ * \param _RR      Speed-up MPI used for recalculations
+ *
+ * \return         0 if successful,
+ *                 POLARSSL_ERR_MPI_MALLOC_FAILED if memory allocation failed,
+ *                 POLARSSL_ERR_MPI_BAD_INPUT_DATA if N is negative or even or if
+ *                 E is negative
+ */
+int mpi_exp_mod_fixed( mpi *X, const mpi *A, const mpi *E, const mpi *N,
+                       mpi *_RR );
+
 /**
  * \brief          Fill an MPI X with size bytes of random
  *
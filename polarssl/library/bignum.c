@@ -1444,12 +1444,50 @@ static void mpi_montg_init( t_uint *mm, const mpi *N )
     *mm = ~x + 1;
 }
 
+#if defined(POLARSSL_HAVE_UDBL)
+/*
+ * Same as mpi_mul_hlp, written with the double-width type so that the
+ * compiler can keep the carry in registers and unroll when I is known
+ * (MULQ/ADC with unsigned __int128 on x86-64).
+ */
+static inline __attribute__ ((always_inline))
+t_uint mpi_mul_hlp_udbl( size_t i, const t_uint *s, t_uint *d, t_uint b )
+{
+    t_udbl r;
+    t_uint c = 0;
+
+    for( ; i > 0; i-- )
+    {
+        r = (t_udbl) *s++ * b + *d + c;
+        *d++ = (t_uint) r;
+        c = (t_uint)( r >> biL );
+    }
+
+    *d += c; c = ( *d < c );
+    return c;
+}
+#endif
+
+/*
+ * The helper used by the Montgomery routines.  On ARM, the assembler
+ * version of mpi_mul_hlp is faster for full rows.
+ */
+#if defined(POLARSSL_HAVE_UDBL) && !(defined(POLARSSL_HAVE_ASM) && defined(__arm__))
+#define MPI_MONT_HLP mpi_mul_hlp_udbl
+#else
+#define MPI_MONT_HLP mpi_mul_hlp
+#endif
+
 /*
  * Montgomery multiplication: A = A * B * R^-1 mod N  (HAC 14.36)
  * A is placed at the upper half of D.
+ *
+ * This is inlined into the size specific routines, so that N is known
+ * at compile time there.
  */
-static void mpi_montmul( size_t n, const t_uint *np, t_uint mm, t_uint *d,
-                         const t_uint *bp )
+static inline __attribute__ ((always_inline))
+void mpi_montmul_core( size_t n, const t_uint *np, t_uint mm, t_uint *d,
+                       const t_uint *bp )
 {
     size_t i;
     t_uint u0, u1, c = 0;
@@ -1463,8 +1501,8 @@ static void mpi_montmul( size_t n, const t_uint *np, t_uint mm, t_uint *d,
         d[n] = c;
         u1 = ( d[0] + u0 * bp[0] ) * mm;
 
-        mpi_mul_hlp( n, bp, d, u0 );
-        c = mpi_mul_hlp( n, np, d, u1 );
+        MPI_MONT_HLP( n, bp, d, u0 );
+        c = MPI_MONT_HLP( n, np, d, u1 );
         d++;
     }
 
@@ -1475,6 +1513,12 @@ static void mpi_montmul( size_t n, const t_uint *np, t_uint mm, t_uint *d,
         mpi_sub_hlp( n, d - n, d - n);
 }
 
+static void mpi_montmul( size_t n, const t_uint *np, t_uint mm, t_uint *d,
+                         const t_uint *bp )
+{
+    mpi_montmul_core( n, np, mm, d, bp );
+}
+
 /*
  * Montgomery reduction: A = A * R^-1 mod N
  * A is placed at the upper half of D.
@@ -1500,7 +1544,7 @@ static void mpi_montred( size_t n, const t_uint *np, t_uint mm, t_uint *d )
             d[j] += c; c = ( d[j] < c );
           }
 
-        c = mpi_mul_hlp( n, np, d, u1 );
+        c = MPI_MONT_HLP( n, np, d, u1 );
         d++;
     }
 
@@ -1521,8 +1565,12 @@ static void mpi_montred( size_t n, const t_uint *np, t_uint mm, t_uint *d )
  * d (destination): the result [<-- temp -->][<--- A ---->]
  *                               lower part    upper part
  *                                   n-limb       n-limb
+ * On ARM, rows are done in assembler (with UMAAL on Cortex-M4).
+ * Otherwise, with the double-width type (x86-64), the cross products
+ * are computed once, doubled and the squares added, then reduced.
  */
-static void mpi_montsqr( size_t n, const t_uint *np, t_uint mm, t_uint *d )
+static inline __attribute__ ((always_inline))
+void mpi_montsqr_core( size_t n, const t_uint *np, t_uint mm, t_uint *d )
 {
 #if defined(POLARSSL_HAVE_ASM) && defined(__arm__)
   size_t i;
@@ -1650,6 +1698,54 @@ static void mpi_montsqr( size_t n, const t_uint *np, t_uint mm, t_uint *d )
 
   d += n;
 
+  /* prevent timing attacks */
+  if( ((mpi_cmp_abs_limbs ( n, d, np ) >= 0) | c) )
+      mpi_sub_hlp( n, np, d );
+  else
+      mpi_sub_hlp( n, d - n, d - n);
+#elif defined(POLARSSL_HAVE_UDBL)
+  size_t i;
+  t_uint a[n];
+  t_uint c, top, x0, x1;
+  t_udbl r;
+
+  memcpy (a, &d[n], sizeof (a));
+  memset (d, 0, 2 * n * ciL);
+
+  /* W := sum of a_i * a_j for i < j, each product computed once.  */
+  for (i = 0; i + 1 < n; i++)
+    mpi_mul_hlp_udbl (n - i - 1, &a[i + 1], &d[2*i + 1], a[i]);
+
+  /* W := 2 * W + sum of a_i * a_i.  */
+  c = top = 0;
+  for (i = 0; i < n; i++)
+    {
+      r = (t_udbl) a[i] * a[i] + c;
+
+      x0 = (d[2*i] << 1) | top;
+      x1 = (d[2*i + 1] << 1) | (d[2*i] >> (biL - 1));
+      top = d[2*i + 1] >> (biL - 1);
+
+      x0 += (t_uint) r;
+      c = (t_uint)(r >> biL) + (x0 < (t_uint) r);
+      x1 += c;
+      c = (x1 < c);
+
+      d[2*i] = x0;
+      d[2*i + 1] = x1;
+    }
+
+  /* Reduction, one limb at a time.  */
+  c = 0;
+  for (i = 0; i < n; i++)
+    {
+      d[i + n] += c;
+      c = (d[i + n] < c);
+      c += MPI_MONT_HLP (n, np, &d[i], d[i] * mm);
+    }
+
+  d += n;
+
   /* prevent timing attacks */
   if( ((mpi_cmp_abs_limbs ( n, d, np ) >= 0) | c) )
       mpi_sub_hlp( n, np, d );
@@ -1659,10 +1755,15 @@ static void mpi_montsqr( size_t n, const t_uint *np, t_uint mm, t_uint *d )
   t_uint a_input[n];
 
   memcpy (a_input, &d[n], sizeof (a_input));
-  mpi_montmul (n, np, mm, d, a_input);
+  mpi_montmul_core (n, np, mm, d, a_input);
 #endif
 }
 
+static void mpi_montsqr( size_t n, const t_uint *np, t_uint mm, t_uint *d )
+{
+    mpi_montsqr_core( n, np, mm, d );
+}
+
 /*
  * Sliding-window exponentiation: X = A^E mod N  (HAC 14.85)
  */
@@ -1857,6 +1958,245 @@ cleanup:
     return( ret );
 }
 
+/*
+ * Fixed-window exponentiation for the modulus of fixed size, used for
+ * RSA private key operation with CRT (1024-bit for RSA-2048, 2048-bit
+ * for RSA-4096).
+ *
+ * Unlike mpi_exp_mod, the sequence of squarings and multiplications
+ * doesn't depend on E, and an entry of the table is selected by
+ * reading all entries.  The number of limbs is a constant, so that
+ * the loops can be unrolled by the compiler.
+ */
+#if MEMORY_SIZE >= 24
+#define FIXED_WSIZE_2048 4
+#else
+#define FIXED_WSIZE_2048 3
+#endif
+#define FIXED_WSIZE_1024 4
+
+/*
+ * Constant-time table lookup: R = TABLE[IDX]
+ */
+static inline __attribute__ ((always_inline))
+void mpi_select_ct( size_t n, t_uint *r, const t_uint *table, size_t num,
+                    t_uint idx )
+{
+    size_t i, j;
+
+    memset( r, 0, n * ciL );
+    for( i = 0; i < num; i++ )
+    {
+        t_uint x = (t_uint)i ^ idx;
+        t_uint mask = ( ( x | ( ~x + 1 ) ) >> ( biL - 1 ) ) - 1;
+
+        for( j = 0; j < n; j++ )
+            r[j] |= table[i * n + j] & mask;
+    }
+}
+
+/*
+ * Get WSIZE bits of E at POS.  POS is public, the value is not.
+ */
+static inline __attribute__ ((always_inline))
+t_uint mpi_get_window( size_t n, const t_uint *e, size_t pos, size_t wsize )
+{
+    size_t li = pos / biL;
+    size_t bi = pos % biL;
+    t_uint v = e[li] >> bi;
+
+    if( bi + wsize > biL && li + 1 < n )
+        v |= e[li + 1] << ( biL - bi );
+
+    return( v & ( ( (t_uint)1 << wsize ) - 1 ) );
+}
+
+static inline __attribute__ ((always_inline))
+int mpi_exp_mod_fixed_window( mpi *X, const mpi *A, const mpi *E,
+                              const mpi *N, mpi *_RR,
+                              size_t n, size_t wsize,
+                              void (*montmul)( const t_uint *, t_uint,
+                                               t_uint *, const t_uint * ),
+                              void (*montsqr)( const t_uint *, t_uint,
+                                               t_uint * ) )
+{
+    int ret = 0;
+    size_t i, j;
+    size_t nwin = ( n * biL + wsize - 1 ) / wsize;
+    t_uint mm;
+    mpi RR;
+    t_uint d[n * 2];
+    t_uint *e, *w, *wn;
+
+    /*
+     * The exponent, a table entry and the table (W[i] at wn + i * n)
+     * are on heap, not to use much of the stack of the caller.
+     */
+    e = (t_uint *) malloc( ( ( (size_t)1 << wsize ) + 2 ) * n * ciL );
+    if( e == NULL )
+        return( POLARSSL_ERR_MPI_MALLOC_FAILED );
+    w = e + n;
+    wn = w + n;
+
+    mpi_montg_init( &mm, N );
+
+    memset( e, 0, n * ciL );
+    memcpy( e, E->p, ( E->n < n ? E->n : n ) * ciL );
+
+    /*
+     * If 1st call, pre-compute R^2 mod N
+     */
+    if( _RR == NULL || _RR->p == NULL )
+    {
+        mpi T;
+
+        mpi_init( &RR );
+        T.s = 1; T.n = n * 2; T.p = d;
+        memset( d, 0, sizeof( d ) );
+        mpi_sub_hlp( n, N->p, d + n );
+        MPI_CHK( mpi_mod_mpi( &RR, &T, N ) );
+        MPI_CHK( mpi_grow( &RR, n ) );
+
+        if( _RR != NULL )
+            memcpy( _RR, &RR, sizeof( mpi ) );
+    }
+    else
+        memcpy( &RR, _RR, sizeof( mpi ) );
+
+    MPI_CHK( mpi_grow( X, n ) );
+
+    /*
+     * W[0] = R^2 * R^-1 mod N = R mod N
+     */
+    memset( d, 0, n * ciL );
+    memcpy( d + n, RR.p, n * ciL );
+    mpi_montred( n, N->p, mm, d );
+    memcpy( wn, d + n, n * ciL );
+
+    /*
+     * W[1] = A * R^2 * R^-1 mod N = A * R mod N
+     */
+    if( mpi_cmp_mpi( A, N ) >= 0 )
+    {
+        mpi W1;
+
+        W1.s = 1; W1.n = n; W1.p = d + n;
+        MPI_CHK( mpi_mod_mpi( &W1, A, N ) );
+    }
+    else
+    {
+        memset( d + n, 0, n * ciL );
+        memcpy( d + n, A->p, ( A->n < n ? A->n : n ) * ciL );
+    }
+
+    montmul( N->p, mm, d, RR.p );
+    memcpy( wn + n, d + n, n * ciL );
+
+    /*
+     * W[i] = W[i - 1] * W[1]
+     */
+    for( i = 2; i < ( (size_t)1 << wsize ); i++ )
+    {
+        montmul( N->p, mm, d, wn + n );
+        memcpy( wn + i * n, d + n, n * ciL );
+    }
+
+    /*
+     * X = W[top window], then for each window:
+     * X = X^(2^wsize) * W[window] R^-1 mod N
+     */
+    mpi_select_ct( n, d + n, wn, (size_t)1 << wsize,
+                   mpi_get_window( n, e, ( nwin - 1 ) * wsize, wsize ) );
+
+    for( i = nwin - 1; i > 0; i-- )
+    {
+        for( j = 0; j < wsize; j++ )
+            montsqr( N->p, mm, d );
+
+        mpi_select_ct( n, w, wn, (size_t)1 << wsize,
+                       mpi_get_window( n, e, ( i - 1 ) * wsize, wsize ) );
+        montmul( N->p, mm, d, w );
+    }
+
+    /*
+     * X = A^E * R * R^-1 mod N = A^E mod N
+     */
+    mpi_montred( n, N->p, mm, d );
+    memcpy( X->p, d + n, n * ciL );
+    memset( X->p + n, 0, ( X->n - n ) * ciL );
+    X->s = 1;
+
+cleanup:
+    memset( d, 0, sizeof( d ) );
+    memset( e, 0, ( ( (size_t)1 << wsize ) + 2 ) * n * ciL );
+    free( e );
+
+    if( _RR == NULL )
+        mpi_free( &RR );
+
+    return( ret );
+}
+
+static void mpi_montmul_1024( const t_uint *np, t_uint mm, t_uint *d,
+                              const t_uint *bp )
+{
+    mpi_montmul_core( 1024 / biL, np, mm, d, bp );
+}
+
+static void mpi_montsqr_1024( const t_uint *np, t_uint mm, t_uint *d )
+{
+    mpi_montsqr_core( 1024 / biL, np, mm, d );
+}
+
+static int mpi_exp_mod_1024( mpi *X, const mpi *A, const mpi *E,
+                             const mpi *N, mpi *_RR )
+{
+    return mpi_exp_mod_fixed_window( X, A, E, N, _RR,
+                                     1024 / biL, FIXED_WSIZE_1024,
+                                     mpi_montmul_1024, mpi_montsqr_1024 );
+}
+
+static void mpi_montmul_2048( const t_uint *np, t_uint mm, t_uint *d,
+                              const t_uint *bp )
+{
+    mpi_montmul_core( 2048 / biL, np, mm, d, bp );
+}
+
+static void mpi_montsqr_2048( const t_uint *np, t_uint mm, t_uint *d )
+{
+    mpi_montsqr_core( 2048 / biL, np, mm, d );
+}
+
+static int mpi_exp_mod_2048( mpi *X, const mpi *A, const mpi *E,
+                             const mpi *N, mpi *_RR )
+{
+    return mpi_exp_mod_fixed_window( X, A, E, N, _RR,
+                                     2048 / biL, FIXED_WSIZE_2048,
+                                     mpi_montmul_2048, mpi_montsqr_2048 );
+}
+
+int mpi_exp_mod_fixed( mpi *X, const mpi *A, const mpi *E, const mpi *N,
+                       mpi *_RR )
+{
+    size_t nbits = mpi_msb( N );
+
+    if( mpi_cmp_int( N, 0 ) < 0 || ( N->p[0] & 1 ) == 0 )
+        return( POLARSSL_ERR_MPI_BAD_INPUT_DATA );
+
+    if( mpi_cmp_int( E, 0 ) < 0 )
+        return( POLARSSL_ERR_MPI_BAD_INPUT_DATA );
+
+    if( A->s == -1 )
+        return( POLARSSL_ERR_MPI_BAD_INPUT_DATA );
+
+    if( nbits == 1024 && mpi_msb( E ) <= 1024 )
+        return mpi_exp_mod_1024( X, A, E, N, _RR );
+    else if( nbits == 2048 && mpi_msb( E ) <= 2048 )
+        return mpi_exp_mod_2048( X, A, E, N, _RR );
+    else
+        return mpi_exp_mod( X, A, E, N, _RR );
+}
+
 /*
  * Greatest common divisor: G = gcd(A, B)  (HAC 14.54)
  */
@@ -2021,61 +2361,71 @@ cleanup:
 
 #if defined(POLARSSL_GENPRIME)
 
-static const int small_prime[] =
+/*
+ * Small primes which don't divide M (see below): 97, and from 709
+ * to 4093 except 797.  Used to sieve the candidates.
+ */
+static const uint16_t sieve_prime[] =
 {
-#if 0
-        3,    5,    7,   11,   13,   17,   19,   23,
-       29,   31,   37,   41,   43,   47,   53,   59,
-       61,   67,   71,   73,   79,   83,   89,   97,
-      101,  103,  107,  109,  113,  127,  131,  137,
-      139,  149,  151,  157,  163,  167,  173,  179,
-      181,  191,  193,  197,  199,  211,  223,  227,
-      229,  233,  239,  241,  251,  257,  263,  269,
-      271,  277,  281,  283,  293,  307,  311,  313,
-      317,  331,  337,  347,  349,  353,  359,  367,
-      373,  379,  383,  389,  397,  401,  409,  419,
-      421,  431,  433,  439,  443,  449,  457,  461,
-      463,  467,  479,  487,  491,  499,  503,  509,
-      521,  523,  541,  547,  557,  563,  569,  571,
-      577,  587,  593,  599,  601,  607,  613,  617,
-      619,  631,  641,  643,  647,  653,  659,  661,
-      673,  677,  683,  691,  701,
-#else
-       97,
-#endif
-                                    709,  719,  727,
-      733,  739,  743,  751,  757,  761,  769,  773,
-      787,  
-#if 0
-            797,
-#endif
-                  809,  811,  821,  823,  827,  829,
-      839,  853,  857,  859,  863,  877,  881,  883,
-      887,  907,  911,  919,  929,  937,  941,  947,
-      953,  967,  971,  977,  983,  991,  997, 
-#if 1
-                                               1009, 
-     1013, 1019, 1021, 1031, 1033, 1039, 1049, 1051,
-     1061, 1063, 1069, 1087, 1091, 1093, 1097, 1103,
-     1109, 1117, 1123, 1129, 1151, 1153, 1163, 1171,
-     1181, 1187, 1193, 1201, 1213, 1217, 1223, 1229,
-     1231, 1237, 1249, 1259, 1277, 1279, 1283, 1289,
-     1291, 1297, 1301, 1303, 1307, 1319, 1321, 1327,
-     1361, 1367, 1373, 1381, 1399, 1409, 1423, 1427,
-     1429, 1433, 1439, 1447, 1451, 1453, 1459, 1471,
-     1481, 1483, 1487, 1489, 1493, 1499, 1511, 1523,
-     1531, 1543, 1549, 1553, 1559, 1567, 1571, 1579,
-     1583, 1597, 1601, 1607, 1609, 1613, 1619, 1621,
-     1627, 1637, 1657, 1663, 1667, 1669, 1693, 1697,
-     1699, 1709, 1721, 1723, 1733, 1741, 1747, 1753,
-     1759, 1777, 1783, 1787, 1789, 1801, 1811, 1823,
-     1831, 1847, 1861, 1867, 1871, 1873, 1877, 1879,
-     1889,
-#endif
-
-     -103
+      97,  709,  719,  727,  733,  739,  743,  751,
+     757,  761,  769,  773,  787,  809,  811,  821,
+     823,  827,  829,  839,  853,  857,  859,  863,
+     877,  881,  883,  887,  907,  911,  919,  929,
+     937,  941,  947,  953,  967,  971,  977,  983,
+     991,  997, 1009, 1013, 1019, 1021, 1031, 1033,
+    1039, 1049, 1051, 1061, 1063, 1069, 1087, 1091,
+    1093, 1097, 1103, 1109, 1117, 1123, 1129, 1151,
+    1153, 1163, 1171, 1181, 1187, 1193, 1201, 1213,
+    1217, 1223, 1229, 1231, 1237, 1249, 1259, 1277,
+    1279, 1283, 1289, 1291, 1297, 1301, 1303, 1307,
+    1319, 1321, 1327, 1361, 1367, 1373, 1381, 1399,
+    1409, 1423, 1427, 1429, 1433, 1439, 1447, 1451,
+    1453, 1459, 1471, 1481, 1483, 1487, 1489, 1493,
+    1499, 1511, 1523, 1531, 1543, 1549, 1553, 1559,
+    1567, 1571, 1579, 1583, 1597, 1601, 1607, 1609,
+    1613, 1619, 1621, 1627, 1637, 1657, 1663, 1667,
+    1669, 1693, 1697, 1699, 1709, 1721, 1723, 1733,
+    1741, 1747, 1753, 1759, 1777, 1783, 1787, 1789,
+    1801, 1811, 1823, 1831, 1847, 1861, 1867, 1871,
+    1873, 1877, 1879, 1889, 1901, 1907, 1913, 1931,
+    1933, 1949, 1951, 1973, 1979, 1987, 1993, 1997,
+    1999, 2003, 2011, 2017, 2027, 2029, 2039, 2053,
+    2063, 2069, 2081, 2083, 2087, 2089, 2099, 2111,
+    2113, 2129, 2131, 2137, 2141, 2143, 2153, 2161,
+    2179, 2203, 2207, 2213, 2221, 2237, 2239, 2243,
+    2251, 2267, 2269, 2273, 2281, 2287, 2293, 2297,
+    2309, 2311, 2333, 2339, 2341, 2347, 2351, 2357,
+    2371, 2377, 2381, 2383, 2389, 2393, 2399, 2411,
+    2417, 2423, 2437, 2441, 2447, 2459, 2467, 2473,
+    2477, 2503, 2521, 2531, 2539, 2543, 2549, 2551,
+    2557, 2579, 2591, 2593, 2609, 2617, 2621, 2633,
+    2647, 2657, 2659, 2663, 2671, 2677, 2683, 2687,
+    2689, 2693, 2699, 2707, 2711, 2713, 2719, 2729,
+    2731, 2741, 2749, 2753, 2767, 2777, 2789, 2791,
+    2797, 2801, 2803, 2819, 2833, 2837, 2843, 2851,
+    2857, 2861, 2879, 2887, 2897, 2903, 2909, 2917,
+    2927, 2939, 2953, 2957, 2963, 2969, 2971, 2999,
+    3001, 3011, 3019, 3023, 3037, 3041, 3049, 3061,
+    3067, 3079, 3083, 3089, 3109, 3119, 3121, 3137,
+    3163, 3167, 3169, 3181, 3187, 3191, 3203, 3209,
+    3217, 3221, 3229, 3251, 3253, 3257, 3259, 3271,
+    3299, 3301, 3307, 3313, 3319, 3323, 3329, 3331,
+    3343, 3347, 3359, 3361, 3371, 3373, 3389, 3391,
+    3407, 3413, 3433, 3449, 3457, 3461, 3463, 3467,
+    3469, 3491, 3499, 3511, 3517, 3527, 3529, 3533,
+    3539, 3541, 3547, 3557, 3559, 3571, 3581, 3583,
+    3593, 3607, 3613, 3617, 3623, 3631, 3637, 3643,
+    3659, 3671, 3673, 3677, 3691, 3697, 3701, 3709,
+    3719, 3727, 3733, 3739, 3761, 3767, 3769, 3779,
+    3793, 3797, 3803, 3821, 3823, 3833, 3847, 3851,
+    3853, 3863, 3877, 3881, 3889, 3907, 3911, 3917,
+    3919, 3923, 3929, 3931, 3943, 3947, 3967, 3989,
+    4001, 4003, 4007, 4013, 4019, 4021, 4027, 4049,
+    4051, 4057, 4073, 4079, 4091, 4093
 };
 
+#define SIEVE_PRIME_NUM (sizeof (sieve_prime) / sizeof (sieve_prime[0]))
+
 /*
  * From Public domain code of JKISS RNG.
  *
@@ -2129,7 +2479,7 @@ static int mpi_fill_pseudo_random ( mpi *X, size_t size)
 
   /* Assume little endian.  */
   p = (uint32_t *)X->p;
-  p_end = (uint32_t *)(X->p + (size/sizeof (uint32_t)));
+  p_end = p + (size/sizeof (uint32_t));
   while (p < p_end)
     *p++ = jkiss (&jkiss_state_v);
 
@@ -2141,7 +2491,7 @@ cleanup:
 }
 
 /*
- * Miller-Rabin primality test  (HAC 4.24)
+ * Fermat test with 2, then Miller-Rabin primality test  (HAC 4.24)
  */
 static
 int mpi_is_prime( mpi *X)
@@ -2171,18 +2521,10 @@ int mpi_is_prime( mpi *X)
         return( POLARSSL_ERR_MPI_NOT_ACCEPTABLE );
 #endif
 
-    for( i = 0; small_prime[i] > 0; i++ )
-    {
-        t_uint r;
-
-        if( mpi_cmp_int( X, small_prime[i] ) <= 0 )
-            return( 0 );
-
-        MPI_CHK( mpi_mod_int( &r, X, small_prime[i] ) );
-
-        if( r == 0 )
-            return( POLARSSL_ERR_MPI_NOT_ACCEPTABLE );
-    }
+    /*
+     * No trial division here: the candidates from mpi_gen_prime are
+     * coprime to M and have been sieved with sieve_prime[].
+     */
 
     /*
      * W = |X| - 1
@@ -2307,41 +2649,87 @@ static const t_uint limbs_M[] = { /* Little endian */
 static const mpi M[1] = {{ 1, M_LIMBS, (t_uint *)limbs_M }};
 
 /*
- * MAX_A : 2^1024 / M - 1
+ * Candidates are sieved by a window of SIEVE_WINDOW.
  */
-#ifdef __LP64__
-#define MAX_A_LIMBS 1
-#else
-#define MAX_A_LIMBS 2
-#endif
-#define MAX_A_FILL_SIZE  6
-static const t_uint limbs_MAX_A[] = { /* Little endian */
-#ifdef __LP64__
-  0x0003FE2556A2B35FUL
-#else
-  0x56A2B35F, 0x0003FE25
-#endif
-};
+#define SIEVE_WINDOW 256
+
+/*
+ * Inverse of Y modulo small prime P.
+ */
+static t_uint small_prime_inv (t_uint y, t_uint p)
+{
+  t_sint t0 = 0, t1 = 1, t;
+  t_uint r0 = p, r1 = y, q, r;
+
+  while (r1 != 0)
+    {
+      q = r0 / r1;
+      r = r0 - q * r1;  r0 = r1;  r1 = r;
+      t = t0 - (t_sint)q * t1;  t0 = t1;  t1 = t;
+    }
 
-static const mpi MAX_A[1] = {{ 1, MAX_A_LIMBS, (t_uint *)limbs_MAX_A }};
+  return t0 < 0 ? (t_uint)(t0 + p) : (t_uint)t0;
+}
+
+/*
+ * Mark the candidates X + k*M (0 <= k < SIEVE_WINDOW) which have
+ * a factor in sieve_prime[].
+ */
+static int mpi_sieve (unsigned char *sieve, const mpi *X)
+{
+  int ret = 0;
+  size_t i, k;
+  t_uint p, r, m;
+
+  memset (sieve, 0, SIEVE_WINDOW / 8);
+  for (i = 0; i < SIEVE_PRIME_NUM; i++)
+    {
+      p = sieve_prime[i];
+      MPI_CHK ( mpi_mod_int ( &r, X, p ) );
+      MPI_CHK ( mpi_mod_int ( &m, M, p ) );
+
+      /* X + k*M = 0 (mod p)  <=>  k = -X * M^-1 (mod p) */
+      for (k = ((p - r) * small_prime_inv (m, p)) % p; k < SIEVE_WINDOW;
+           k += p)
+        sieve[k / 8] |= 1 << (k % 8);
+    }
+
+cleanup:
+  return ret;
+}
 
 /*
  * Prime number generation
  *
- * Special version for 1024-bit only.  Ignores DH_FLAG.
+ * For NBITS >= 1024.  Ignores DH_FLAG.
+ *
+ * Candidate is A*M + B, where B is coprime to M.  Stepping by M keeps
+ * it coprime to M, and the sieve rejects most of other composites
+ * before any exponentiation.
  */
 int mpi_gen_prime( mpi *X, size_t nbits, int dh_flag,
                    int (*f_rng)(void *, unsigned char *, size_t),
                    void *p_rng )
 {
   int ret;
-  mpi B[1], G[1];
+  mpi B[1], G[1], MAX_A[1];
+  size_t fill_size, k;
+  unsigned char sieve[SIEVE_WINDOW / 8];
 
   (void)dh_flag;
-  if (nbits != 1024)
+  if (nbits < 1024 || nbits > POLARSSL_MPI_MAX_BITS)
     return POLARSSL_ERR_MPI_BAD_INPUT_DATA;
 
-  mpi_init ( B );  mpi_init ( G );
+  mpi_init ( B );  mpi_init ( G );  mpi_init ( MAX_A );
+
+  /*
+   * MAX_A : 2^NBITS / M - 1
+   */
+  MPI_CHK ( mpi_lset ( MAX_A, 1 ) );
+  MPI_CHK ( mpi_shift_l ( MAX_A, nbits ) );
+  MPI_CHK ( mpi_div_mpi ( MAX_A, NULL, MAX_A, M ) );
+  MPI_CHK ( mpi_sub_int ( MAX_A, MAX_A, 1 ) );
+  fill_size = (mpi_msb ( MAX_A ) - 2) / 8;
 
   /*
    * Get random value 1 to M-1 avoiding bias, and proceed when it is
@@ -2361,25 +2749,39 @@ int mpi_gen_prime( mpi *X, size_t nbits, int dh_flag,
 
   /*
    * Get random value avoiding bias, comput P with the value,
-   * check if it's big enough, lastly, check if it's prime.
+   * check if it's big enough, lastly, search a prime from there.
    */
   while (1)
     {
-      MPI_CHK( mpi_fill_random( X, MAX_A_FILL_SIZE, f_rng, p_rng ) );
+      MPI_CHK( mpi_fill_random( X, fill_size, f_rng, p_rng ) );
       MPI_CHK ( mpi_sub_abs (X, MAX_A, X) );
 
       MPI_CHK ( mpi_mul_mpi ( X, X, M ) );
       MPI_CHK ( mpi_add_abs ( X, X, B ) );
-      if (X->n <= M_LIMBS || (X->p[M_LIMBS-1] & 0xc0000000) == 0)
-        continue;
-      ret = mpi_is_prime ( X );
-      if (ret == 0 || ret != POLARSSL_ERR_MPI_NOT_ACCEPTABLE)
-        break;
+
+      while (mpi_msb (X) == nbits && mpi_get_bit (X, nbits - 2))
+        {
+          MPI_CHK ( mpi_sieve ( sieve, X ) );
+
+          for (k = 0; k < SIEVE_WINDOW; k++)
+            {
+              if ((sieve[k / 8] & (1 << (k % 8))) == 0)
+                {
+                  ret = mpi_is_prime ( X );
+                  if (ret == 0 || ret != POLARSSL_ERR_MPI_NOT_ACCEPTABLE)
+                    goto cleanup;
+                }
+
+              MPI_CHK ( mpi_add_abs ( X, X, M ) );
+              if (mpi_msb (X) != nbits)
+                break;
+            }
+        }
     }
 
 cleanup:
 
-  mpi_free ( B );  mpi_free ( G );
+  mpi_free ( B );  mpi_free ( G );  mpi_free ( MAX_A );
 
   return ret;
 }
@@ -310,8 +310,8 @@ int rsa_private( rsa_context *ctx,
      * T1 = input ^ dP mod P
      * T2 = input ^ dQ mod Q
      */
-    MPI_CHK( mpi_exp_mod( &T1, &T, &ctx->DP, &ctx->P, &ctx->RP ) );
-    MPI_CHK( mpi_exp_mod( &T2, &T, &ctx->DQ, &ctx->Q, &ctx->RQ ) );
+    MPI_CHK( mpi_exp_mod_fixed( &T1, &T, &ctx->DP, &ctx->P, &ctx->RP ) );
+    MPI_CHK( mpi_exp_mod_fixed( &T2, &T, &ctx->DQ, &ctx->Q, &ctx->RQ ) );
 
     /*
      * T = (T1 - T2) * (Q^-1 mod P) mod P
@@ -670,7 +670,7 @@ int rsa_rsaes_pkcs1_v15_decrypt( rsa_context *ctx,
     size_t ilen, pad_count = 0;
     unsigned char *p, *q;
     unsigned char bt;
-    unsigned char buf[ctx->len];
+    unsigned char *buf = output;
 
     if( ctx->padding != RSA_PKCS_V15 )
         return( POLARSSL_ERR_RSA_BAD_INPUT_DATA );
@@ -680,6 +680,14 @@ int rsa_rsaes_pkcs1_v15_decrypt( rsa_context *ctx,
     if( ilen < 16)
         return( POLARSSL_ERR_RSA_BAD_INPUT_DATA );
 
+    /*
+     * Decrypt into OUTPUT directly (then, move the message to the
+     * top), so that no buffer on stack is needed.  INPUT may overlap
+     * with OUTPUT, as it is read at first.
+     */
+    if( ilen > output_max_len )
+        return( POLARSSL_ERR_RSA_OUTPUT_TOO_LARGE );
+
     ret = ( mode == RSA_PUBLIC )
           ? rsa_public(  ctx, input, buf )
           : rsa_private( ctx, f_rng, p_rng, input, buf );
@@ -741,11 +749,8 @@ int rsa_rsaes_pkcs1_v15_decrypt( rsa_context *ctx,
     if( correct == 0 )
         return( POLARSSL_ERR_RSA_INVALID_PADDING );
 
-    if (ilen - (p - buf) > output_max_len)
-        return( POLARSSL_ERR_RSA_OUTPUT_TOO_LARGE );
-
     *olen = ilen - (p - buf);
-    memcpy( output, p, *olen );
+    memmove( output, p, *olen );
 
     return( 0 );
 }
@@ -969,7 +974,8 @@ int rsa_rsassa_pkcs1_v15_sign( rsa_context *ctx,
     switch( hash_id )
     {
         case SIG_RSA_RAW:
-            memcpy( p, hash, hashlen );
+            /* HASH may be placed at P already, for signing in place */
+            memmove( p, hash, hashlen );
             break;
 
         case SIG_RSA_MD2:
@@ -30,11 +30,13 @@
 
 int
 FUNC(ecdsa_sign) (const uint8_t *hash, uint8_t *output,
-		  const uint8_t *key_data)
+		  const uint8_t *key_data, int nonce_mode)
 {
   int i;
   bn256 r[1], s[1], z[1], d[1];
   uint8_t *p;
+  uint8_t salt[8];
+  const uint8_t *extra = NULL;
 
   p = (uint8_t *)d;
   for (i = 0; i < ECDSA_BYTE_SIZE; i++)
@@ -44,7 +46,15 @@ FUNC(ecdsa_sign) (const uint8_t *hash, uint8_t *output,
   for (i = 0; i < ECDSA_BYTE_SIZE; i++)
     p[ECDSA_BYTE_SIZE - i - 1] = hash[i];
 
-  FUNC(ecdsa) (r, s, z, d);
+  if (nonce_mode == ECDSA_NONCE_HEDGED)
+    {
+      random_get_salt (salt);
+      extra = salt;
+    }
+
+  FUNC(ecdsa) (r, s, z, d, nonce_mode != ECDSA_NONCE_RANDOM,
+	       extra, sizeof salt);
+  memset (d, 0, sizeof d);
   p = (uint8_t *)r;
   for (i = 0; i < ECDSA_BYTE_SIZE; i++)
     *output++ = p[ECDSA_BYTE_SIZE - i - 1];
@@ -24,6 +24,9 @@
 
 #include <stdint.h>
 #include <string.h>
+#include "config.h"
+#include "gnuk.h"
+#include "random.h"
 #include "bn.h"
 #include "affine.h"
 #include "jpc-ac_p256k1.h"
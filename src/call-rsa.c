@@ -45,35 +45,125 @@ rsa_cleanup (void *arg)
 }
 
 
+/*
+ * Compute CRT parameters (dP, dQ and qInv) of the RSA private key P_Q,
+ * and write them to CRT.
+ *
+ * LEN: length of the private key data (p and q) in byte
+ */
 int
-rsa_sign (const uint8_t *raw_message, uint8_t *output, int msg_len,
-	  struct key_data *kd, int pubkey_len)
+rsa_crt_compute (const uint8_t *p_q, int len, uint8_t *crt)
 {
-  mpi P1, Q1, H;
-  int ret = 0;
-  unsigned char temp[pubkey_len];
+  mpi P, Q, E, D, P1, Q1, H, T;
+  int ret;
 
-  rsa_init (&rsa_ctx, RSA_PKCS_V15, 0);
+  mpi_init (&P);  mpi_init (&Q);  mpi_init (&E);  mpi_init (&D);
+  mpi_init (&P1);  mpi_init (&Q1);  mpi_init (&H);  mpi_init (&T);
 
-  mpi_init (&P1);  mpi_init (&Q1);  mpi_init (&H);
+  MPI_CHK( mpi_lset (&E, 0x10001) );
+  MPI_CHK( mpi_read_binary (&P, &p_q[0], len / 2) );
+  MPI_CHK( mpi_read_binary (&Q, &p_q[len / 2], len / 2) );
+  MPI_CHK( mpi_sub_int (&P1, &P, 1) );
+  MPI_CHK( mpi_sub_int (&Q1, &Q, 1) );
+  MPI_CHK( mpi_mul_mpi (&H, &P1, &Q1) );
+  MPI_CHK( mpi_inv_mod (&D , &E, &H) );
+  MPI_CHK( mpi_mod_mpi (&T, &D, &P1) );
+  MPI_CHK( mpi_write_binary (&T, &crt[0], len / 2) );
+  MPI_CHK( mpi_mod_mpi (&T, &D, &Q1) );
+  MPI_CHK( mpi_write_binary (&T, &crt[len / 2], len / 2) );
+  MPI_CHK( mpi_inv_mod (&T, &Q, &P) );
+  MPI_CHK( mpi_write_binary (&T, &crt[len], len / 2) );
 
-  rsa_ctx.len = pubkey_len;
+ cleanup:
+  mpi_free (&P);  mpi_free (&Q);  mpi_free (&E);  mpi_free (&D);
+  mpi_free (&P1);  mpi_free (&Q1);  mpi_free (&H);  mpi_free (&T);
+  if (ret != 0)
+    {
+      memset (crt, 0, len / 2 * 3);
+      return -1;
+    }
+
+  return 0;
+}
+
+struct rsa_crt rsa_crt;
+
+/*
+ * Compute CRT parameters of the private key in KD, and keep them in
+ * RSA_CRT, so that private key operations by the same key only pay
+ * for the exponentiation.
+ *
+ * LEN: length of the private key data (p and q) in byte
+ */
+int
+rsa_crt_precompute (const struct key_data *kd, int len)
+{
+  rsa_crt.kd = NULL;
+  if (rsa_crt_compute (kd->data, len, (uint8_t *)rsa_crt.data) < 0)
+    return -1;
+
+  rsa_crt.kd = kd;
+  return 0;
+}
+
+void
+rsa_crt_clear (void)
+{
+  rsa_crt.kd = NULL;
+  memset (rsa_crt.data, 0, MAX_RSA_CRT_LEN);
+}
+
+/*
+ * Set up RSA_CTX for private key operation by the key in KD, using
+ * the CRT parameters in RSA_CRT (computed, if they are of other key).
+ *
+ * LEN: length of the private key data (p and q) in byte
+ */
+static int
+rsa_ctx_setup_private (struct key_data *kd, int len)
+{
+  int ret = 0;
+  const uint8_t *crt = (const uint8_t *)rsa_crt.data;
+
+  if (rsa_crt.kd != kd && rsa_crt_precompute (kd, len) < 0)
+    return -1;
+
+  rsa_ctx.len = len;
   MPI_CHK( mpi_lset (&rsa_ctx.E, 0x10001) );
-  MPI_CHK( mpi_read_binary (&rsa_ctx.P, &kd->data[0], pubkey_len / 2) );
-  MPI_CHK( mpi_read_binary (&rsa_ctx.Q, &kd->data[pubkey_len / 2],
-			    pubkey_len / 2) );
+  MPI_CHK( mpi_read_binary (&rsa_ctx.P, &kd->data[0], len / 2) );
+  MPI_CHK( mpi_read_binary (&rsa_ctx.Q, &kd->data[len / 2], len / 2) );
 #if 0
   MPI_CHK( mpi_mul_mpi (&rsa_ctx.N, &rsa_ctx.P, &rsa_ctx.Q) );
 #endif
-  MPI_CHK( mpi_sub_int (&P1, &rsa_ctx.P, 1) );
-  MPI_CHK( mpi_sub_int (&Q1, &rsa_ctx.Q, 1) );
-  MPI_CHK( mpi_mul_mpi (&H, &P1, &Q1) );
-  MPI_CHK( mpi_inv_mod (&rsa_ctx.D , &rsa_ctx.E, &H) );
-  MPI_CHK( mpi_mod_mpi (&rsa_ctx.DP, &rsa_ctx.D, &P1) );
-  MPI_CHK( mpi_mod_mpi (&rsa_ctx.DQ, &rsa_ctx.D, &Q1) );
-  MPI_CHK( mpi_inv_mod (&rsa_ctx.QP, &rsa_ctx.Q, &rsa_ctx.P) );
+  MPI_CHK( mpi_read_binary (&rsa_ctx.DP, &crt[0], len / 2) );
+  MPI_CHK( mpi_read_binary (&rsa_ctx.DQ, &crt[len / 2], len / 2) );
+  MPI_CHK( mpi_read_binary (&rsa_ctx.QP, &crt[len], len / 2) );
  cleanup:
-  mpi_free (&P1);  mpi_free (&Q1);  mpi_free (&H);
+  return ret;
+}
+
+
+int
+rsa_sign (const uint8_t *raw_message, uint8_t *output, int msg_len,
+	  struct key_data *kd, int pubkey_len)
+{
+  int ret = 0;
+  uint8_t *hash;
+
+  if (msg_len > pubkey_len - 11)
+    return -1;
+
+  /*
+   * Sign in place: place the message at the end of OUTPUT, where it
+   * is for the padding, and let the result be written to OUTPUT.
+   * RAW_MESSAGE may be same to OUTPUT.
+   */
+  hash = output + pubkey_len - msg_len;
+  memmove (hash, raw_message, msg_len);
+
+  rsa_init (&rsa_ctx, RSA_PKCS_V15, 0);
+
+  ret = rsa_ctx_setup_private (kd, pubkey_len);
   if (ret == 0)
     {
       int cs;
@@ -86,8 +176,7 @@ rsa_sign (const uint8_t *raw_message, uint8_t *output, int msg_len,
       cs = chopstx_setcancelstate (0); /* Allow cancellation.  */
       ret = rsa_rsassa_pkcs1_v15_sign (&rsa_ctx, NULL, NULL,
 				       RSA_PRIVATE, SIG_RSA_RAW,
-				       msg_len, raw_message, temp);
-      memcpy (output, temp, pubkey_len);
+				       msg_len, hash, output);
       chopstx_setcancelstate (cs);
       chopstx_cleanup_pop (0);
     }
@@ -134,7 +223,6 @@ int
 rsa_decrypt (const uint8_t *input, uint8_t *output, int msg_len,
 	     struct key_data *kd, unsigned int *output_len_p)
 {
-  mpi P1, Q1, H;
   int ret;
 #ifdef GNU_LINUX_EMULATION
   size_t output_len;
@@ -144,26 +232,9 @@ rsa_decrypt (const uint8_t *input, uint8_t *output, int msg_len,
   DEBUG_WORD ((uint32_t)&ret);
 
   rsa_init (&rsa_ctx, RSA_PKCS_V15, 0);
-  mpi_init (&P1);  mpi_init (&Q1);  mpi_init (&H);
-
-  rsa_ctx.len = msg_len;
   DEBUG_WORD (msg_len);
 
-  MPI_CHK( mpi_lset (&rsa_ctx.E, 0x10001) );
-  MPI_CHK( mpi_read_binary (&rsa_ctx.P, &kd->data[0], msg_len / 2) );
-  MPI_CHK( mpi_read_binary (&rsa_ctx.Q, &kd->data[msg_len / 2], msg_len / 2) );
-#if 0
-  MPI_CHK( mpi_mul_mpi (&rsa_ctx.N, &rsa_ctx.P, &rsa_ctx.Q) );
-#endif
-  MPI_CHK( mpi_sub_int (&P1, &rsa_ctx.P, 1) );
-  MPI_CHK( mpi_sub_int (&Q1, &rsa_ctx.Q, 1) );
-  MPI_CHK( mpi_mul_mpi (&H, &P1, &Q1) );
-  MPI_CHK( mpi_inv_mod (&rsa_ctx.D , &rsa_ctx.E, &H) );
-  MPI_CHK( mpi_mod_mpi (&rsa_ctx.DP, &rsa_ctx.D, &P1) );
-  MPI_CHK( mpi_mod_mpi (&rsa_ctx.DQ, &rsa_ctx.D, &Q1) );
-  MPI_CHK( mpi_inv_mod (&rsa_ctx.QP, &rsa_ctx.Q, &rsa_ctx.P) );
- cleanup:
-  mpi_free (&P1);  mpi_free (&Q1);  mpi_free (&H);
+  ret = rsa_ctx_setup_private (kd, msg_len);
   if (ret == 0)
     {
       int cs;
@@ -240,17 +311,15 @@ int
 rsa_genkey (int pubkey_len, uint8_t *pubkey, uint8_t *p_q)
 {
   int ret;
-  uint8_t index = 0;
   uint8_t *p = p_q;
   uint8_t *q = p_q + pubkey_len / 2;
   int cs;
 
   extern int prng_seed (int (*f_rng)(void *, unsigned char *, size_t),
 			void *p_rng);
-  extern void neug_flush (void);
 
-  neug_flush ();
-  prng_seed (random_gen, &index);
+  random_reseed (RANDOM_FOR_RSA);
+  prng_seed (random_gen, NULL);
   rsa_init (&rsa_ctx, RSA_PKCS_V15, 0);
 
   clp.next = NULL;
@@ -258,7 +327,7 @@ rsa_genkey (int pubkey_len, uint8_t *pubkey, uint8_t *p_q)
   clp.arg = NULL;
   chopstx_cleanup_push (&clp);
   cs = chopstx_setcancelstate (0); /* Allow cancellation.  */
-  MPI_CHK( rsa_gen_key (&rsa_ctx, random_gen, &index, pubkey_len * 8,
+  MPI_CHK( rsa_gen_key (&rsa_ctx, random_gen, NULL, pubkey_len * 8,
 			RSA_EXPONENT) );
   MPI_CHK( mpi_write_binary (&rsa_ctx.P, p, pubkey_len / 2) );
   MPI_CHK( mpi_write_binary (&rsa_ctx.Q, q, pubkey_len / 2) );
@@ -34,6 +34,7 @@
 #include "affine.h"
 #include "jpc-ac_p256k1.h"
 #include "mod.h"
+#include "sha256.h"
 #include "ec_p256k1.h"
 
 #define FIELD p256k1
@@ -53,6 +54,9 @@ static const bn256 coefficient_b[1] = {
 };
 
 
+#if defined(ECC_COMB_WIDTH) && ECC_COMB_WIDTH != 4
+#include "ec_p256k1-comb.h"
+#else
 static const ac precomputed_KG[15] = {
   {
     {{{ 0x16f81798, 0x59f2815b, 0x2dce28d9, 0x029bfcdb,
@@ -210,6 +214,7 @@ static const ac precomputed_2E_KG[15] = {
 	0x0a3f3b4d, 0xf671f423, 0x59942dc3, 0xb49acb47 }}}
   }
 };
+#endif
 
 /*
  * N: order of G
@@ -230,4 +235,51 @@ static const bn256 MU_lower[1] = {
 };
 
 
+/*
+ * Endomorphism: LAMBDA * (x, y) = (BETA * x, y)
+ *
+ * LAMBDA = 0x5363AD4CC05C30E0A5261C028812645A122E22EA20816678DF02967C1B23BD72
+ *   BETA = 0x7AE96A2B657C07106E64479EAC3434E99CF0497512F58995C1396C28719501EE
+ */
+#define ENDOMORPHISM_GLV 1
+
+static const bn256 glv_beta[1] = {
+  {{ 0x719501ee, 0xc1396c28, 0x12f58995, 0x9cf04975,
+     0xac3434e9, 0x6e64479e, 0x657c0710, 0x7ae96a2b }}
+};
+
+/*
+ * The basis of the lattice {(a, b) | a + b * LAMBDA = 0 mod N}:
+ *   (A1, B1), (A2, B2), where B2 = A1
+ */
+static const bn256 glv_a1[1] = {
+  {{ 0x9284eb15, 0xe86c90e4, 0xa7d46bcd, 0x3086d221,
+     0x00000000, 0x00000000, 0x00000000, 0x00000000 }}
+};
+
+static const bn256 glv_minus_b1[1] = {
+  {{ 0x0abfe4c3, 0x6f547fa9, 0x010e8828, 0xe4437ed6,
+     0x00000000, 0x00000000, 0x00000000, 0x00000000 }}
+};
+
+static const bn256 glv_a2[1] = {
+  {{ 0x9d44cfd8, 0x57c1108d, 0xa8e2f3f6, 0x14ca50f7,
+     0x00000001, 0x00000000, 0x00000000, 0x00000000 }}
+};
+
+/*
+ * G1 = round (2^384 * B2 / N)
+ * G2 = round (2^384 * -B1 / N)
+ */
+static const bn256 glv_g1[1] = {
+  {{ 0x45dbb031, 0xe893209a, 0x71e8ca7f, 0x3daa8a14,
+     0x9284eb15, 0xe86c90e4, 0xa7d46bcd, 0x3086d221 }}
+};
+
+static const bn256 glv_g2[1] = {
+  {{ 0x8ac47f71, 0x1571b4ae, 0x9df506c6, 0x221208ac,
+     0x0abfe4c4, 0x6f547fa9, 0x010e8828, 0xe4437ed6 }}
+};
+
+
 #include "ecc.c"
@@ -28,6 +28,7 @@
 #include "affine.h"
 #include "jpc-ac_p256r1.h"
 #include "mod.h"
+#include "sha256.h"
 #include "ec_p256r1.h"
 
 #define FIELD p256r1
@@ -47,6 +48,9 @@ static const bn256 coefficient_b[1] = {
 };
 
 
+#if defined(ECC_COMB_WIDTH) && ECC_COMB_WIDTH != 4
+#include "ec_p256r1-comb.h"
+#else
 static const ac precomputed_KG[15] = {
   {
     {{{ 0xd898c296, 0xf4a13945, 0x2deb33a0, 0x77037d81,
@@ -204,6 +208,7 @@ static const ac precomputed_2E_KG[15] = {
 	0x461210fb, 0x557d9f49, 0xb8753f81, 0x4ab5b6b2 }}}
   }
 };
+#endif
 
 /*
  * N: order of G
@@ -244,6 +244,9 @@ point_ptc_to_ac (ac *X, const ptc *A)
   /*
    * A->z may be bigger than p25519, or two times bigger than p25519.
    * But this is no problem for computation of mod_inv.
+   *
+   * A is the result of scalar multiplication by secret (or by the
+   * nonce), so, use constant time inverse.
    */
   mod_inv (z_inv, A->z, p25519);
 
@@ -63,15 +63,33 @@
  */
 
 /*
- * w = 4
+ * w = ECC_COMB_WIDTH (4, 5, or 6)
  * m = 256
- * d = 64
- * e = 32
+ * d = 64, 52, or 44  (w * d >= m, and d is even)
+ * e = d / 2
+ *
+ * A larger W means fewer doublings and additions (e and d), but
+ * larger tables (2^w - 1 entries each).  The tables for W=5 and W=6
+ * are generated at build time by tool/calc_precompute_table_ecc.py.
  */
+#ifndef ECC_COMB_WIDTH
+#define ECC_COMB_WIDTH 4
+#endif
+
+#if ECC_COMB_WIDTH == 4
+#define COMB_D 64
+#elif ECC_COMB_WIDTH == 5
+#define COMB_D 52
+#elif ECC_COMB_WIDTH == 6
+#define COMB_D 44
+#else
+#error "ECC_COMB_WIDTH should be 4, 5, or 6"
+#endif
+#define COMB_E (COMB_D / 2)
 
 /*
- * static const ac precomputed_KG[15];
- * static const ac precomputed_2E_KG[15];
+ * static const ac precomputed_KG[2^w - 1];
+ * static const ac precomputed_2E_KG[2^w - 1];
  */
 
 #if TEST
@@ -85,20 +103,18 @@ const ac *G = &precomputed_KG[0];
 static int
 get_vk (const bn256 *K, int i)
 {
-  uint32_t w0, w1, w2, w3;
+  int vk = 0;
+  int r;
 
-  if (i < 32)
-    {
-      w3 = K->word[6]; w2 = K->word[4]; w1 = K->word[2]; w0 = K->word[0];
-    }
-  else
+  for (r = 0; r < ECC_COMB_WIDTH; r++)
     {
-      w3 = K->word[7]; w2 = K->word[5]; w1 = K->word[3]; w0 = K->word[1];
-      i -= 32;
+      int pos = i + r * COMB_D;
+
+      if (pos < 256)
+	vk |= ((K->word[pos / 32] >> (pos % 32)) & 1) << r;
     }
 
-  w3 >>= i;  w2 >>= i;  w1 >>= i;  w0 >>= i;
-  return ((w3 & 1) << 3) | ((w2 & 1) << 2) | ((w1 & 1) << 1) | (w0 & 1);
+  return vk;
 }
 
 
@@ -113,8 +129,8 @@ get_vk (const bn256 *K, int i)
 int
 FUNC(compute_kG) (ac *X, const bn256 *K)
 {
-  uint8_t index[64]; /* Lower 4-bit for index absolute value, msb is
-			for sign (encoded as: 0 means 1, 1 means -1).  */
+  uint8_t index[COMB_D]; /* Lower W-bit for index absolute value, msb is
+			    for sign (encoded as: 0 means 1, 1 means -1).  */
   bn256 K_dash[1];
   jpc Q[1], tmp[1], *dst;
   int i;
@@ -126,7 +142,7 @@ FUNC(compute_kG) (ac *X, const bn256 *K)
 
   /* Fill index.  */
   vk = get_vk (K_dash, 0);
-  for (i = 1; i < 64; i++)
+  for (i = 1; i < COMB_D; i++)
     {
       int vk_next, is_zero;
 
@@ -135,15 +151,15 @@ FUNC(compute_kG) (ac *X, const bn256 *K)
       index[i-1] = (vk - 1) | (is_zero << 7);
       vk = (is_zero ? vk : vk_next);
     }
-  index[63] = vk - 1;
+  index[COMB_D - 1] = vk - 1;
 
   memset (Q->z, 0, sizeof (bn256)); /* infinity */
-  for (i = 31; i >= 0; i--)
+  for (i = COMB_E - 1; i >= 0; i--)
     {
       FUNC(jpc_double) (Q, Q);
-      FUNC(jpc_add_ac_signed) (Q, Q, &precomputed_2E_KG[index[i+32]&0x0f],
-			       index[i+32] >> 7);
-      FUNC(jpc_add_ac_signed) (Q, Q, &precomputed_KG[index[i]&0x0f],
+      FUNC(jpc_add_ac_signed) (Q, Q, &precomputed_2E_KG[index[i+COMB_E]&0x7f],
+			       index[i+COMB_E] >> 7);
+      FUNC(jpc_add_ac_signed) (Q, Q, &precomputed_KG[index[i]&0x7f],
 			       index[i] >> 7);
     }
 
@@ -217,6 +233,221 @@ get_vk_kP (const bn256 *K, int i)
   return w;
 }
 
+/*
+ * Compute P357[] = { 3P, 5P, 7P }.
+ *
+ * They are computed from P only, which is public (the point from
+ * peer), so, variable time conversion is OK.  The three points are
+ * kept in Jacobian coordinates and converted to affine together,
+ * with a single inverse.
+ */
+static int
+precompute_odd_multiples (ac *P357, const ac *P)
+{
+  jpc Q[1], T[3];
+
+  memcpy (Q->x, P->x, sizeof (bn256));
+  memcpy (Q->y, P->y, sizeof (bn256));
+  memset (Q->z, 0, sizeof (bn256));
+  Q->z->word[0] = 1;
+
+  FUNC(jpc_double) (Q, Q);		/* 2P */
+  FUNC(jpc_add_ac) (&T[0], Q, P);	/* 3P */
+  FUNC(jpc_double) (Q, Q);		/* 4P */
+  FUNC(jpc_add_ac) (&T[1], Q, P);	/* 5P */
+  FUNC(jpc_double) (Q, &T[0]);		/* 6P */
+  FUNC(jpc_add_ac) (&T[2], Q, P);	/* 7P */
+
+  /* Never fails, except coding errors.  */
+  return FUNC(jpc_to_ac_multi_vartime) (P357, T, 3);
+}
+
+/*
+ * Fill INDEX with N signed odd digits of K' (odd), by 3-bit window.
+ */
+static void
+fill_index_kP (uint8_t *index, const bn256 *K_dash, int n)
+{
+  int i;
+  int vk;
+
+  vk = get_vk_kP (K_dash, 0);
+  for (i = 1; i < n; i++)
+    {
+      int vk_next, is_even;
+
+      vk_next = get_vk_kP (K_dash, i);
+      is_even = ((vk_next & 1) == 0);
+      index[i-1] = (is_even << 7) | ((is_even?7-vk:vk-1) >> 1);
+      vk = vk_next + is_even;
+    }
+  index[n-1] = ((vk - 1) >> 1);
+}
+
+#ifdef ENDOMORPHISM_GLV
+/*
+ * X = round (A / 2^384)
+ */
+static void
+round_shift_384 (bn256 *X, const bn512 *A)
+{
+  memcpy (X->word, &A->word[12], 4 * sizeof (uint32_t));
+  memset (&X->word[4], 0, 4 * sizeof (uint32_t));
+  bn256_add_uint (X, X, A->word[11] >> 31);
+}
+
+/*
+ * Interpret X as a signed integer (two's complement), replace it by
+ * its absolute value, and return its sign (1 if negative).
+ * Constant time.
+ */
+static uint32_t
+abs_signed (bn256 *X)
+{
+  bn256 minus_X[1];
+  uint32_t neg = X->word[7] >> 31;
+  uint32_t mask = 0UL - neg;
+  int i;
+
+  memset (minus_X, 0, sizeof (bn256));
+  bn256_sub (minus_X, minus_X, X);
+  for (i = 0; i < BN256_WORDS; i++)
+    X->word[i] = (X->word[i] & ~mask) | (minus_X->word[i] & mask);
+
+  return neg;
+}
+
+/*
+ * Decompose K into K1 + K2 * LAMBDA (mod N), where |K1|, |K2| < 2^128.
+ *
+ *   c1 = round (K * B2 / N), c2 = round (K * -B1 / N)
+ *   K1 = K - c1 * A1 - c2 * A2
+ *   K2 = - c1 * B1 - c2 * B2
+ *
+ * Return absolute values in K1 and K2, and their signs.
+ */
+static void
+glv_split (bn256 *K1, uint32_t *k1_neg, bn256 *K2, uint32_t *k2_neg,
+	   const bn256 *K)
+{
+  bn512 tmp[1];
+  bn256 c1[1], c2[1];
+
+  bn256_mul (tmp, K, glv_g1);
+  round_shift_384 (c1, tmp);
+  bn256_mul (tmp, K, glv_g2);
+  round_shift_384 (c2, tmp);
+
+  /* Products are smaller than 2^256, and the results are small.  */
+  bn256_mul (tmp, c1, glv_a1);
+  bn256_sub (K1, K, (bn256 *)tmp);
+  bn256_mul (tmp, c2, glv_a2);
+  bn256_sub (K1, K1, (bn256 *)tmp);
+
+  bn256_mul (tmp, c1, glv_minus_b1);
+  memcpy (K2, tmp, sizeof (bn256));
+  bn256_mul (tmp, c2, glv_a1);
+  bn256_sub (K2, K2, (bn256 *)tmp);
+
+  *k1_neg = abs_signed (K1);
+  *k2_neg = abs_signed (K2);
+
+  memset (tmp, 0, sizeof (bn512));
+  memset (c1, 0, sizeof (bn256));
+  memset (c2, 0, sizeof (bn256));
+}
+
+/**
+ * @brief	X  = k * P
+ *
+ * @param K	scalar k
+ * @param P	P in affine coordiate
+ *
+ * Return -1 on error.
+ * Return 0 on success.
+ *
+ * Using the endomorphism, k * P = k1 * P + k2 * (LAMBDA * P), where
+ * k1 and k2 are about half size of k.  Both are computed together,
+ * with 3-bit signed windows, thus, number of doublings is half.
+ */
+int
+FUNC(compute_kP) (ac *X, const bn256 *K, const ac *P)
+{
+  uint8_t index1[43]; /* Lower 2-bit for index absolute value, msb is
+			 for sign (encoded as: 0 means 1, 1 means -1).  */
+  uint8_t index2[43];
+  bn256 K1[1], K2[1];
+  uint32_t k1_neg, k2_neg;
+  uint32_t k1_is_even, k2_is_even;
+  jpc Q[1], tmp[1], *dst;
+  int i;
+  ac P357[3];
+  ac L1[1], L3[1], L5[1], L7[1];
+  const ac *p_Pi[4];
+  const ac *p_Li[4];
+
+  if (point_is_on_the_curve (P) < 0)
+    return -1;
+
+  if (bn256_sub (K1, K, N) == 0)	/* >= N, it's too big.  */
+    return -1;
+
+  glv_split (K1, &k1_neg, K2, &k2_neg, K);
+
+  k1_is_even = bn256_is_even (K1);
+  k2_is_even = bn256_is_even (K2);
+  bn256_add_uint (K1, K1, k1_is_even);
+  bn256_add_uint (K2, K2, k2_is_even);
+  /* Now, K1' and K2' are odd, and < 2^128 + 1.  */
+
+  if (precompute_odd_multiples (P357, P) < 0)
+    return -1;
+
+  /* LAMBDA * (x, y) = (BETA * x, y) */
+  MFNC(mul) (L1->x, P->x, glv_beta);
+  memcpy (L1->y, P->y, sizeof (bn256));
+  MFNC(mul) (L3->x, P357[0].x, glv_beta);
+  memcpy (L3->y, P357[0].y, sizeof (bn256));
+  MFNC(mul) (L5->x, P357[1].x, glv_beta);
+  memcpy (L5->y, P357[1].y, sizeof (bn256));
+  MFNC(mul) (L7->x, P357[2].x, glv_beta);
+  memcpy (L7->y, P357[2].y, sizeof (bn256));
+
+  p_Pi[0] = P;
+  p_Pi[1] = &P357[0];
+  p_Pi[2] = &P357[1];
+  p_Pi[3] = &P357[2];
+  p_Li[0] = L1;
+  p_Li[1] = L3;
+  p_Li[2] = L5;
+  p_Li[3] = L7;
+
+  fill_index_kP (index1, K1, 43);
+  fill_index_kP (index2, K2, 43);
+  memset (K1, 0, sizeof (bn256));
+  memset (K2, 0, sizeof (bn256));
+
+  memset (Q->z, 0, sizeof (bn256)); /* infinity */
+  for (i = 42; i >= 0; i--)
+    {
+      FUNC(jpc_double) (Q, Q);
+      FUNC(jpc_double) (Q, Q);
+      FUNC(jpc_double) (Q, Q);
+      FUNC(jpc_add_ac_signed) (Q, Q, p_Pi[index1[i]&0x03],
+			       (index1[i] >> 7) ^ k1_neg);
+      FUNC(jpc_add_ac_signed) (Q, Q, p_Li[index2[i]&0x03],
+			       (index2[i] >> 7) ^ k2_neg);
+    }
+
+  /* Subtract what was added to make K1' and K2' odd.  */
+  dst = k1_is_even ? Q : tmp;
+  FUNC(jpc_add_ac_signed) (dst, Q, P, k1_neg ^ 1);
+  dst = k2_is_even ? Q : tmp;
+  FUNC(jpc_add_ac_signed) (dst, Q, L1, k2_neg ^ 1);
+
+  return FUNC(jpc_to_ac) (X, Q);
+}
+#else
 /**
  * @brief	X  = k * P
  *
@@ -244,8 +475,7 @@ FUNC(compute_kP) (ac *X, const bn256 *K, const ac *P)
   uint32_t k_is_even = bn256_is_even (K);
   jpc Q[1], tmp[1], *dst;
   int i;
-  int vk;
-  ac P3[1], P5[1], P7[1];
+  ac P357[3];
   const ac *p_Pi[4];
 
   if (point_is_on_the_curve (P) < 0)
@@ -258,49 +488,14 @@ FUNC(compute_kP) (ac *X, const bn256 *K, const ac *P)
   /* It keeps the condition: 1 <= K' <= N - 2, and K' is odd.  */
 
   p_Pi[0] = P;
-  p_Pi[1] = P3;
-  p_Pi[2] = P5;
-  p_Pi[3] = P7;
-
-  {
-    jpc Q1[1];
-
-    memcpy (Q->x, P->x, sizeof (bn256));
-    memcpy (Q->y, P->y, sizeof (bn256));
-    memset (Q->z, 0, sizeof (bn256));
-    Q->z->word[0] = 1;
-
-    FUNC(jpc_double) (Q, Q);
-    FUNC(jpc_add_ac) (Q1, Q, P);
-    if (FUNC(jpc_to_ac) (P3, Q1) < 0) /* Never occurs, except coding errors.  */
-      return -1;
-    FUNC(jpc_double) (Q, Q);
-    FUNC(jpc_add_ac) (Q1, Q, P);
-    if (FUNC(jpc_to_ac) (P5, Q1) < 0) /* Never occurs, except coding errors.  */
-      return -1;
-
-    memcpy (Q->x, P3->x, sizeof (bn256));
-    memcpy (Q->y, P3->y, sizeof (bn256));
-    memset (Q->z, 0, sizeof (bn256));
-    Q->z->word[0] = 1;
-    FUNC(jpc_double) (Q, Q);
-    FUNC(jpc_add_ac) (Q1, Q, P);
-    if (FUNC(jpc_to_ac) (P7, Q1) < 0) /* Never occurs, except coding errors.  */
-      return -1;
-  }
+  p_Pi[1] = &P357[0];
+  p_Pi[2] = &P357[1];
+  p_Pi[3] = &P357[2];
 
-  /* Fill index.  */
-  vk = get_vk_kP (K_dash, 0);
-  for (i = 1; i < 86; i++)
-    {
-      int vk_next, is_even;
+  if (precompute_odd_multiples (P357, P) < 0)
+    return -1;
 
-      vk_next = get_vk_kP (K_dash, i);
-      is_even = ((vk_next & 1) == 0);
-      index[i-1] = (is_even << 7) | ((is_even?7-vk:vk-1) >> 1);
-      vk = vk_next + is_even;
-    }
-  index[85] = ((vk - 1) >> 1);
+  fill_index_kP (index, K_dash, 86);
 
   memset (Q->z, 0, sizeof (bn256)); /* infinity */
   for (i = 85; i >= 0; i--)
@@ -316,31 +511,155 @@ FUNC(compute_kP) (ac *X, const bn256 *K, const ac *P)
 
   return FUNC(jpc_to_ac) (X, Q);
 }
+#endif
+
 
+/*
+ * Deterministic generation of K, by HMAC_DRBG of RFC 6979.
+ * Its state is K and V of the RFC (not to be confused with our K,
+ * the scalar).
+ */
+typedef struct {
+  uint8_t key[32];
+  uint8_t v[32];
+  int need_update;
+} rfc6979_state;
+
+static void
+bn256_to_octets (uint8_t *out, const bn256 *X)
+{
+  const uint8_t *p = (const uint8_t *)X;
+  int i;
+
+  for (i = 0; i < 32; i++)
+    out[i] = p[31 - i];
+}
+
+static void
+rfc6979_hmac_update (rfc6979_state *st, uint8_t c,
+		     const uint8_t *x, const uint8_t *h1,
+		     const uint8_t *extra, int extra_len)
+{
+  hmac_sha256_context hctx;
+
+  /* K = HMAC_K(V || c || x || h1 || extra) */
+  hmac_sha256_start (&hctx, st->key, 32);
+  hmac_sha256_update (&hctx, st->v, 32);
+  hmac_sha256_update (&hctx, &c, 1);
+  if (x)
+    {
+      hmac_sha256_update (&hctx, x, 32);
+      hmac_sha256_update (&hctx, h1, 32);
+      if (extra)
+	hmac_sha256_update (&hctx, extra, extra_len);
+    }
+  hmac_sha256_finish (&hctx, st->key);
+
+  /* V = HMAC_K(V) */
+  hmac_sha256_start (&hctx, st->key, 32);
+  hmac_sha256_update (&hctx, st->v, 32);
+  hmac_sha256_finish (&hctx, st->v);
+
+  memset (&hctx, 0, sizeof hctx);
+}
+
+/*
+ * Steps from b. to g. of RFC 6979 3.2.  When EXTRA is given, it is
+ * the additional data k' of 3.6, so that K is hedged with randomness.
+ */
+static void
+rfc6979_init (rfc6979_state *st, const bn256 *z, const bn256 *d,
+	      const uint8_t *extra, int extra_len)
+{
+  uint8_t x[32], h1[32];
+  bn256 tmp[1];
+
+  bn256_to_octets (x, d);
+  /* bits2octets: Z < 2^256 < 2N, so, single subtraction is enough.  */
+  if (bn256_sub (tmp, z, N))
+    bn256_to_octets (h1, z);
+  else
+    bn256_to_octets (h1, tmp);
+
+  memset (st->v, 0x01, 32);
+  memset (st->key, 0x00, 32);
+  rfc6979_hmac_update (st, 0x00, x, h1, extra, extra_len);
+  rfc6979_hmac_update (st, 0x01, x, h1, extra, extra_len);
+  st->need_update = 0;
+
+  memset (x, 0, sizeof x);
+  memset (tmp, 0, sizeof tmp);
+}
+
+/*
+ * Step h. of RFC 6979 3.2.  Since qlen = hlen = 256, T is single V.
+ */
+static void
+rfc6979_generate (rfc6979_state *st, bn256 *k)
+{
+  hmac_sha256_context hctx;
+  bn256 tmp[1];
+  uint8_t *p = (uint8_t *)k;
+  int i;
+
+  while (1)
+    {
+      if (st->need_update)
+	rfc6979_hmac_update (st, 0x00, NULL, NULL, NULL, 0);
+
+      hmac_sha256_start (&hctx, st->key, 32);
+      hmac_sha256_update (&hctx, st->v, 32);
+      hmac_sha256_finish (&hctx, st->v);
+      st->need_update = 1;
+
+      for (i = 0; i < 32; i++)
+	p[i] = st->v[31 - i];
+
+      if (!bn256_is_zero (k) && bn256_sub (tmp, k, N))
+	break;			/* 1 <= k <= N - 1 */
+    }
+
+  memset (&hctx, 0, sizeof hctx);
+  memset (tmp, 0, sizeof tmp);
+}
 
 /**
  * @brief Compute signature (r,s) of hash string z with secret key d
+ *
+ * When DETERMINISTIC is non-zero, K is generated by RFC 6979, with
+ * optional additional data EXTRA of EXTRA_LEN bytes.  Otherwise, K is
+ * random.
  */
 void
-FUNC(ecdsa) (bn256 *r, bn256 *s, const bn256 *z, const bn256 *d)
+FUNC(ecdsa) (bn256 *r, bn256 *s, const bn256 *z, const bn256 *d,
+	     int deterministic, const uint8_t *extra, int extra_len)
 {
   bn256 k[1];
   ac KG[1];
   bn512 tmp[1];
   bn256 k_inv[1];
+  rfc6979_state st[1];
   uint32_t carry;
 #define borrow carry
 #define tmp_k k_inv
 
+  if (deterministic)
+    rfc6979_init (st, z, d, extra, extra_len);
+
   do
     {
       do
 	{
-	  bn256_random (k);
-	  if (bn256_add_uint (k, k, 1))
-	    continue;
-	  if (bn256_sub (tmp_k, k, N) == 0)	/* >= N, it's too big.  */
-	    continue;
+	  if (deterministic)
+	    rfc6979_generate (st, k);
+	  else
+	    {
+	      bn256_random (k);
+	      if (bn256_add_uint (k, k, 1))
+		continue;
+	      if (bn256_sub (tmp_k, k, N) == 0)	/* >= N, it's too big.  */
+		continue;
+	    }
 	  /* 1 <= k <= N - 1 */
 	  FUNC(compute_kG) (KG, k);
 	  borrow = bn256_sub (r, KG->x, N);
@@ -351,7 +670,7 @@ FUNC(ecdsa) (bn256 *r, bn256 *s, const bn256 *z, const bn256 *d)
 	}
       while (bn256_is_zero (r));
 
-      mod_inv (k_inv, k, N);
+      mod_inv (k_inv, k, N);	/* K is secret: constant time */
       bn256_mul (tmp, r, d);
       mod_reduce (s, tmp, N, MU_lower);
       carry = bn256_add (s, s, z);
@@ -364,6 +683,10 @@ FUNC(ecdsa) (bn256 *r, bn256 *s, const bn256 *z, const bn256 *d)
     }
   while (bn256_is_zero (s));
 
+  memset (k, 0, sizeof k);
+  memset (k_inv, 0, sizeof k_inv);
+  memset (st, 0, sizeof st);
+
 #undef tmp_k
 #undef borrow
 }
@@ -58,16 +58,32 @@
  *         a page contains a key data of:
  *              For RSA-2048: 512-byte (p, q and N)
  *              For RSA-4096: 1024-byte (p, q and N)
+ *              For RSA with CRT parameters: double of above
+ *                                           (p, q, N, dP, dQ and qInv)
  *              For ECDSA/ECDH and EdDSA, there are padding after public key
  * _data_pool
- *	   <two pages>
+ *	   <two pages> (four pages for GNU/Linux emulation)
  */
 
+#ifndef FLASH_DATA_POOL_PAGES
+#ifdef GNU_LINUX_EMULATION
+#define FLASH_DATA_POOL_PAGES		4
+#else
+#define FLASH_DATA_POOL_PAGES		2
+#endif
+#endif
+#if FLASH_DATA_POOL_PAGES > 32
+#error "Too many pages for data pool"
+#endif
+
 #define FLASH_DATA_POOL_HEADER_SIZE	2
-#define FLASH_DATA_POOL_SIZE		(flash_page_size*2)
+#define FLASH_DATA_POOL_SIZE		(flash_page_size*FLASH_DATA_POOL_PAGES)
 
 static uint16_t flash_page_size;
-static const uint8_t *data_pool;
+static const uint8_t *data_pool;	/* The page of LAST_P */
+static const uint8_t *data_pool_first;	/* The first page of the log */
+static int data_pool_pages;		/* Number of pages of the log */
+static uint32_t data_pool_erased;	/* Bit map of pages known erased */
 static uint8_t *last_p;
 
 /* The first halfword is generation for the data page (little endian) */
@@ -240,12 +256,119 @@ void flash_set_identity(uint8_t id){
 
 
 #define CHIP_ID_REG      ((uint32_t *)0xe0042000)
+
+/*
+ * Data pool is a log of pages, used in round-robin order.  The first
+ * halfword of a page is its generation, modulo 0xffff.  A page which
+ * continues the log has the generation of its previous page plus two.
+ * A page by copying GC has plus one, and starts new log.  One page is
+ * kept for copying GC, so, the log can be FLASH_DATA_POOL_PAGES - 1
+ * pages long.
+ */
+static uint16_t
+generation_add (uint16_t generation, int n)
+{
+  return (generation + n) % 0xffff;
+}
+
+static int
+generation_newer (uint16_t gen0, uint16_t gen1)
+{
+  int d = (gen0 + 0xffff - gen1) % 0xffff;
+
+  return d > 0 && d < 0x8000;
+}
+
+static const uint8_t *
+data_pool_next_page (const uint8_t *p)
+{
+  p += flash_page_size;
+  if (p >= FLASH_ADDR_DATA_STORAGE_START + FLASH_DATA_POOL_SIZE)
+    p = FLASH_ADDR_DATA_STORAGE_START;
+  return p;
+}
+
+static const uint8_t *
+data_pool_prev_page (const uint8_t *p)
+{
+  if (p == FLASH_ADDR_DATA_STORAGE_START)
+    p += FLASH_DATA_POOL_SIZE;
+  return p - flash_page_size;
+}
+
+#ifdef GNU_LINUX_EMULATION
+static uint32_t data_pool_erase_count[FLASH_DATA_POOL_PAGES];
+
+/* Erase count of a page of data pool, for flash endurance test.  */
+int
+flash_data_pool_erase_count (int i)
+{
+  if (i >= FLASH_DATA_POOL_PAGES)
+    return -1;
+
+  return data_pool_erase_count[i];
+}
+#endif
+
+static int
+data_pool_page_index (const uint8_t *p)
+{
+  return (p - FLASH_ADDR_DATA_STORAGE_START) / flash_page_size;
+}
+
+static void
+flash_data_pool_erase (const uint8_t *p)
+{
+#ifdef GNU_LINUX_EMULATION
+  data_pool_erase_count[data_pool_page_index (p)]++;
+#endif
+  flash_erase_page ((uintptr_t)p);
+  data_pool_erased |= 1U << data_pool_page_index (p);
+}
+
+/*
+ * Check if the page is erased.  Once it's known, it's kept in
+ * DATA_POOL_ERASED until the page is used, so that checking by idle
+ * work doesn't read the whole page again and again.
+ */
+static int
+flash_data_pool_page_erased (const uint8_t *p)
+{
+  const uint32_t *w = (const uint32_t *)p;
+  uint32_t bit = 1U << data_pool_page_index (p);
+
+  if ((data_pool_erased & bit))
+    return 1;
+
+  while (w < (const uint32_t *)(p + flash_page_size))
+    if (*w++ != 0xffffffff)
+      return 0;
+
+  data_pool_erased |= bit;
+  return 1;
+}
+
+/*
+ * Make sure the page is erased before use.  It may be a page of old
+ * log, which is not erased yet, or may have partial copy, when power
+ * off during copying GC.
+ */
+static void
+flash_data_pool_prepare_page (const uint8_t *p)
+{
+  if (!flash_data_pool_page_erased (p))
+    flash_data_pool_erase (p);
+
+  data_pool_erased &= ~(1U << data_pool_page_index (p));
+}
+
 void
 flash_do_storage_init (const uint8_t **p_do_start, const uint8_t **p_do_end)
 {
-  uint16_t gen0, gen1;
-  uint16_t *gen0_p = (uint16_t *)FLASH_ADDR_DATA_STORAGE_START;
-  uint16_t *gen1_p;
+  const uint8_t *p;
+  const uint8_t *head = NULL;
+  uint16_t gen, head_gen = 0xffff;
+  int i;
 
   flash_page_size = 1024;
 #if !defined (GNU_LINUX_EMULATION)
@@ -253,32 +376,65 @@ flash_do_storage_init (const uint8_t **p_do_start, const uint8_t **p_do_end)
     flash_page_size = 2048;
 #endif
 
-  gen1_p = (uint16_t *)(FLASH_ADDR_DATA_STORAGE_START + flash_page_size);
-  data_pool = FLASH_ADDR_DATA_STORAGE_START;
+  data_pool_erased = 0;
 
-  /* Check data pool generation and choose the page */
-  gen0 = *gen0_p;
-  gen1 = *gen1_p;
+  /* Find the newest page.  */
+  for (i = 0; i < FLASH_DATA_POOL_PAGES; i++)
+    {
+      p = FLASH_ADDR_DATA_STORAGE_START + flash_page_size * i;
+      gen = *(const uint16_t *)p;
+      if (gen != 0xffff && (head == NULL || generation_newer (gen, head_gen)))
+	{
+	  head = p;
+	  head_gen = gen;
+	}
+    }
 
-  if (gen0 == 0xffff && gen1 == 0xffff)
+  if (head == NULL)
     {
       /* It's terminated.  */
+      data_pool = data_pool_first = FLASH_ADDR_DATA_STORAGE_START;
+      data_pool_pages = 1;
       *p_do_start = *p_do_end = NULL;
       return;
     }
 
-  if (gen0 == 0xffff)
-    /* Use another page if a page is erased.  */
-    data_pool = FLASH_ADDR_DATA_STORAGE_START + flash_page_size;
-  else if (gen1 == 0xffff)
-    /* Or use different page if another page is erased.  */
-    data_pool = FLASH_ADDR_DATA_STORAGE_START;
-  else if ((gen0 == 0xfffe && gen1 == 0) || gen1 > gen0)
-    /* When both pages have valid header, use newer page.   */
-    data_pool = FLASH_ADDR_DATA_STORAGE_START + flash_page_size;
+  /* Go back to the first page of the log.  */
+  data_pool = data_pool_first = head;
+  data_pool_pages = 1;
+  gen = head_gen;
+  for (p = data_pool_prev_page (head); p != head; p = data_pool_prev_page (p))
+    {
+      uint16_t prev_gen = *(const uint16_t *)p;
+
+      if (prev_gen == 0xffff || generation_add (prev_gen, 2) != gen)
+	break;
+
+      data_pool_first = p;
+      data_pool_pages++;
+      gen = prev_gen;
+    }
 
-  *p_do_start = data_pool + FLASH_DATA_POOL_HEADER_SIZE;
-  *p_do_end = data_pool + flash_page_size;
+  *p_do_start = data_pool_first + FLASH_DATA_POOL_HEADER_SIZE;
+  *p_do_end = data_pool_first + flash_page_size;
+}
+
+/*
+ * Return the start of the page, which follows the page ending at
+ * *P_DO_END, in the log of data pool, updating *P_DO_END.  Return
+ * NULL, when it's the last page.
+ */
+const uint8_t *
+flash_do_storage_next (const uint8_t **p_do_end)
+{
+  const uint8_t *p = *p_do_end - flash_page_size;
+
+  if (p == data_pool)
+    return NULL;
+
+  p = data_pool_next_page (p);
+  *p_do_end = p + flash_page_size;
+  return p + FLASH_DATA_POOL_HEADER_SIZE;
 }
 
 static uint8_t *flash_key_getpage (enum kind_of_key kk);
@@ -296,9 +452,10 @@ flash_terminate (void)
 #endif
   for (i = 0; i < 3; i++)
     flash_erase_page ((uintptr_t)flash_key_getpage (i));
-  flash_erase_page ((uintptr_t)FLASH_ADDR_DATA_STORAGE_START);
-  flash_erase_page ((uintptr_t)(FLASH_ADDR_DATA_STORAGE_START + flash_page_size));
-  data_pool = FLASH_ADDR_DATA_STORAGE_START;
+  for (i = 0; i < FLASH_DATA_POOL_PAGES; i++)
+    flash_data_pool_erase (FLASH_ADDR_DATA_STORAGE_START + flash_page_size * i);
+  data_pool = data_pool_first = FLASH_ADDR_DATA_STORAGE_START;
+  data_pool_pages = 1;
   last_p = FLASH_ADDR_DATA_STORAGE_START + FLASH_DATA_POOL_HEADER_SIZE;
 #if defined(CERTDO_SUPPORT)
   flash_erase_page ((uintptr_t)FLASH_ADDR_CHCERT_START);
@@ -312,6 +469,7 @@ flash_terminate (void)
 void
 flash_activate (void)
 {
+  data_pool_erased &= ~1U;
   flash_program_halfword ((uintptr_t)FLASH_ADDR_DATA_STORAGE_START, 0);
 }
 
@@ -373,34 +531,48 @@ flash_set_data_pool_last (const uint8_t *p)
 }
 
 /*
- * We use two pages
+ * Start new log on the page next to the last page, copying all data
+ * to the page.  Pages of the old log are not erased here, but later,
+ * by flash_data_pool_idle or before use.
  */
 static int
 flash_copying_gc (void)
 {
-  uint8_t *src, *dst;
+  const uint8_t *dst;
   uint16_t generation;
 
-  if (data_pool == FLASH_ADDR_DATA_STORAGE_START)
-    {
-      src = FLASH_ADDR_DATA_STORAGE_START;
-      dst = FLASH_ADDR_DATA_STORAGE_START + flash_page_size;
-    }
-  else
-    {
-      src = FLASH_ADDR_DATA_STORAGE_START + flash_page_size;
-      dst = FLASH_ADDR_DATA_STORAGE_START;
-    }
+  dst = data_pool_next_page (data_pool);
+  generation = generation_add (*(const uint16_t *)data_pool, 1);
 
-  generation = *(uint16_t *)src;
-  data_pool = dst;
+  flash_data_pool_prepare_page (dst);
+  data_pool = data_pool_first = dst;
+  data_pool_pages = 1;
   gpg_data_copy (data_pool + FLASH_DATA_POOL_HEADER_SIZE);
-  if (generation == 0xfffe)
-    generation = 0;
-  else
-    generation++;
+  gpg_do_bump_generation ();
   flash_program_halfword ((uintptr_t)dst, generation);
-  flash_erase_page ((uintptr_t)src);
+  return 0;
+}
+
+/*
+ * Continue the log on the next page, when there is a page other than
+ * the one for copying GC.
+ */
+static int
+flash_data_pool_extend (void)
+{
+  const uint8_t *p;
+  uint16_t generation;
+
+  if (data_pool_pages >= FLASH_DATA_POOL_PAGES - 1)
+    return -1;
+
+  p = data_pool_next_page (data_pool);
+  generation = generation_add (*(const uint16_t *)data_pool, 2);
+  flash_data_pool_prepare_page (p);
+  flash_program_halfword ((uintptr_t)p, generation);
+  data_pool = p;
+  data_pool_pages++;
+  last_p = (uint8_t *)p + FLASH_DATA_POOL_HEADER_SIZE;
   return 0;
 }
 
@@ -410,6 +582,48 @@ is_data_pool_full (size_t size)
   return last_p + size > data_pool + flash_page_size;
 }
 
+/*
+ * Work for data pool when idle, so that a command won't wait for
+ * page erase or copying GC: erase a page which is not in the log, or
+ * else, do copying GC when the log is about to be full.  It does a
+ * page erase at most, so, a command coming next waits not so long.
+ *
+ * Called by OpenPGP thread between commands, on EV_IDLE from CCID
+ * thread.
+ */
+void
+flash_data_pool_idle (void)
+{
+  const uint8_t *p;
+  int i;
+
+  if (data_pool == NULL || *(const uint16_t *)data_pool == 0xffff)
+    return;			/* Not initialized yet, or terminated.  */
+
+  p = data_pool_next_page (data_pool);
+  for (i = data_pool_pages; i < FLASH_DATA_POOL_PAGES; i++)
+    {
+      if (!flash_data_pool_page_erased (p))
+	{
+	  flash_data_pool_erase (p);
+	  return;
+	}
+
+      p = data_pool_next_page (p);
+    }
+
+  /*
+   * Do copying GC, only when it reclaims space so that the new page
+   * has 1/8 free.  Otherwise (live data is too large), GC would run
+   * on every idle, wearing the flash for nothing.
+   */
+  if (data_pool_pages >= FLASH_DATA_POOL_PAGES - 1
+      && is_data_pool_full (flash_page_size / 8)
+      && (FLASH_DATA_POOL_HEADER_SIZE + gpg_data_live_size ()
+	  + flash_page_size / 8) <= flash_page_size)
+    flash_copying_gc ();
+}
+
 static uint8_t *
 flash_data_pool_allocate (size_t size)
 {
@@ -417,7 +631,7 @@ flash_data_pool_allocate (size_t size)
 
   size = (size + 1) & ~1;	/* allocation unit is 1-halfword (2-byte) */
 
-  if (is_data_pool_full (size))
+  if (is_data_pool_full (size) && flash_data_pool_extend () < 0)
     if (flash_copying_gc () < 0 || /*still*/ is_data_pool_full (size))
       fatal (FATAL_FLASH);
 
@@ -426,33 +640,47 @@ flash_data_pool_allocate (size_t size)
   return p;
 }
 
-void
-flash_do_write_internal (const uint8_t *p, int nr, const uint8_t *data, int len)
+/*
+ * Program a run of LEN bytes from SRC at ADDR, a halfword at a time.
+ * If LEN is odd, the last byte is padded by 0xff.
+ * Return 0 on success, -1 on the first failure.
+ */
+int
+flash_program_buffer (uintptr_t addr, const uint8_t *src, size_t len)
 {
   uint16_t hw;
-  uintptr_t addr;
-  int i;
-
-  addr = (uintptr_t)p;
-  hw = nr | (len << 8);
-  if (flash_program_halfword (addr, hw) != 0)
-    flash_warning ("DO WRITE ERROR");
-  addr += 2;
 
-  for (i = 0; i < len/2; i++)
+  while (len >= 2)
     {
-      hw = data[i*2] | (data[i*2+1]<<8);
+      hw = src[0] | (src[1] << 8);
       if (flash_program_halfword (addr, hw) != 0)
-	flash_warning ("DO WRITE ERROR");
+	return -1;
+      src += 2;
       addr += 2;
+      len -= 2;
     }
 
-  if ((len & 1))
+  if (len)
     {
-      hw = data[i*2] | 0xff00;
+      hw = src[0] | 0xff00;
       if (flash_program_halfword (addr, hw) != 0)
-	flash_warning ("DO WRITE ERROR");
+	return -1;
     }
+
+  return 0;
+}
+
+void
+flash_do_write_internal (const uint8_t *p, int nr, const uint8_t *data, int len)
+{
+  uint16_t hw;
+  uintptr_t addr;
+
+  addr = (uintptr_t)p;
+  hw = nr | (len << 8);
+  if (flash_program_halfword (addr, hw) != 0
+      || flash_program_buffer (addr + 2, data, len) != 0)
+    flash_warning ("DO WRITE ERROR");
 }
 
 const uint8_t *
@@ -483,6 +711,20 @@ flash_warning (const char *msg)
   DEBUG_INFO ("\r\n");
 }
 
+/* Keystrings and private key DOs, which should be zeroized on release.  */
+static int
+flash_do_is_secret (uint8_t nr)
+{
+  return nr >= NR_DO_PRVKEY_SIG && nr <= NR_DO_KEYSTRING_PW3;
+}
+
+/*
+ * Release DO.  On scan, the last record of a DO wins, so a DO without
+ * secret is released by writing a zero-length record (a tombstone) of
+ * the same number, instead of filling zero for its content.  The old
+ * content is left until the next GC.  Secret DOs are filled zero.  So
+ * is NR_DO_SEX, as its tombstone would be 0x0000, a released word.
+ */
 void
 flash_do_release (const uint8_t *do_data)
 {
@@ -490,12 +732,20 @@ flash_do_release (const uint8_t *do_data)
   uintptr_t addr_tag = addr;
   int i;
   int len = do_data[0];
+  uint8_t nr = do_data[-1];
 
   /* Don't filling zero for data in code (such as ds_count_initial_value) */
   if (do_data < FLASH_ADDR_DATA_STORAGE_START
       || do_data > FLASH_ADDR_DATA_STORAGE_START + FLASH_DATA_POOL_SIZE)
     return;
 
+  if (nr != NR_DO_SEX && !flash_do_is_secret (nr))
+    {
+      if (flash_do_write (nr, NULL, 0) == NULL)
+	flash_warning ("tombstone failure");
+      return;
+    }
+
   addr += 2;
 
   /* Fill zero for content and pad */
@@ -525,29 +775,51 @@ flash_key_getpage (enum kind_of_key kk)
   return FLASH_ADDR_KEY_STORAGE_START + (flash_page_size * kk);
 }
 
+/*
+ * Allocate a slot for a new key of KK.  It is called after the key of
+ * KK is released, so, each slot in the page should be released (zero)
+ * or unused (0xff).  If not, there are slots of another storage format
+ * (different size, by RSA_CRT_STORAGE_SUPPORT), so, erase the page, as
+ * keys in a page should be at offsets by a single size.  The page is
+ * erased too, when there is no unused slot.
+ */
 uint8_t *
 flash_key_alloc (enum kind_of_key kk)
 {
   uint8_t *k, *k0 = flash_key_getpage (kk);
+  uint8_t *k_unused = NULL;
   int i;
   int key_size = gpg_get_algo_attr_key_size (kk, GPG_KEY_STORAGE);
 
+  if (key_size > flash_page_size)
+    return NULL;
+
   /* Seek free space in the page.  */
-  for (k = k0; k < k0 + flash_page_size; k += key_size)
+  for (k = k0; k + key_size <= k0 + flash_page_size; k += key_size)
     {
       const uint32_t *p = (const uint32_t *)k;
 
+      if (key_available_at (k, key_size))
+	{			/* Different format.  */
+	  k_unused = NULL;
+	  break;
+	}
+
       for (i = 0; i < key_size/4; i++)
 	if (p[i] != 0xffffffff)
 	  break;
 
-      if (i == key_size/4)	/* Yes, it's empty.  */
-	return k;
+      if (i == key_size/4 && k_unused == NULL)	/* Yes, it's empty.  */
+	k_unused = k;
+    }
+
+  if (k_unused == NULL)
+    {
+      flash_key_release_page (kk);
+      k_unused = k0;
     }
 
-  /* Should not happen as we have enough free space all time, but just
-     in case.  */
-  return NULL;
+  return k_unused;
 }
 
 int
@@ -555,26 +827,11 @@ flash_key_write (uint8_t *key_addr,
 		 const uint8_t *key_data, int key_data_len,
 		 const uint8_t *pubkey, int pubkey_len)
 {
-  uint16_t hw;
-  uintptr_t addr;
-  int i;
-
-  addr = (uintptr_t)key_addr;
-  for (i = 0; i < key_data_len/2; i ++)
-    {
-      hw = key_data[i*2] | (key_data[i*2+1]<<8);
-      if (flash_program_halfword (addr, hw) != 0)
-	return -1;
-      addr += 2;
-    }
+  uintptr_t addr = (uintptr_t)key_addr;
 
-  for (i = 0; i < pubkey_len/2; i ++)
-    {
-      hw = pubkey[i*2] | (pubkey[i*2+1]<<8);
-      if (flash_program_halfword (addr, hw) != 0)
-	return -1;
-      addr += 2;
-    }
+  if (flash_program_buffer (addr, key_data, key_data_len) != 0
+      || flash_program_buffer (addr + key_data_len, pubkey, pubkey_len) != 0)
+    return -1;
 
   return 0;
 }
@@ -622,6 +879,12 @@ flash_key_release_page (enum kind_of_key kk)
   flash_erase_page ((uintptr_t)flash_key_getpage (kk));
 }
 
+int
+flash_get_page_size (void)
+{
+  return flash_page_size;
+}
+
 
 void
 flash_clear_halfword (uintptr_t addr)
@@ -872,21 +1135,11 @@ flash_write_binary (uint8_t file_id, const uint8_t *data,
     return -1;
   else
     {
-      uint16_t hw;
-      uintptr_t addr;
-      int i;
-
       if (flash_check_blank (p + offset, len)  == 0)
 	return -1;
 
-      addr = (uintptr_t)p + offset;
-      for (i = 0; i < len/2; i++)
-	{
-	  hw = data[i*2] | (data[i*2+1]<<8);
-	  if (flash_program_halfword (addr, hw) != 0)
-	    flash_warning ("DO WRITE ERROR");
-	  addr += 2;
-	}
+      if (flash_program_buffer ((uintptr_t)p + offset, data, len) != 0)
+	flash_warning ("DO WRITE ERROR");
 
       return 0;
     }
@@ -36,6 +36,7 @@ void ccid_card_change_signal (int how);
 #define EV_CMD_AVAILABLE          4
 #define EV_EXIT                   8
 #define EV_PINPAD_INPUT_DONE     16
+#define EV_IDLE                  32 /* No command, do flash housekeeping */
 
 /* Maximum cmd apdu data is key import 24+4+256+256 (proc_key_import) */
 #define MAX_CMD_APDU_DATA_SIZE (24+4+256+256) /* without header */
@@ -106,7 +107,9 @@ extern uint16_t data_objects_number_of_bytes;
 
 void gpg_data_scan (const uint8_t *start, const uint8_t *end);
 void gpg_data_copy (const uint8_t *p);
+int gpg_data_live_size (void);
 void gpg_do_terminate (void);
+void gpg_do_bump_generation (void);
 void gpg_do_get_data (uint16_t tag, int with_tag);
 void gpg_do_put_data (uint16_t tag, const uint8_t *data, int len);
 void gpg_do_public_key (uint8_t kk_byte);
@@ -138,6 +141,8 @@ int gpg_get_algo_attr (enum kind_of_key kk);
 int gpg_get_algo_attr_key_size (enum kind_of_key kk, enum size_of_key s);
 
 void flash_do_storage_init (const uint8_t **, const uint8_t **);
+const uint8_t *flash_do_storage_next (const uint8_t **);
+void flash_data_pool_idle (void);
 void flash_terminate (void);
 void flash_activate (void);
 void flash_key_storage_init (void);
@@ -146,6 +151,8 @@ const uint8_t *flash_do_write (uint8_t nr, const uint8_t *data, int len);
 uint8_t *flash_key_alloc (enum kind_of_key);
 void flash_key_release (uint8_t *, int);
 void flash_key_release_page (enum kind_of_key);
+int flash_get_page_size (void);
+int flash_program_buffer (uintptr_t addr, const uint8_t *src, size_t len);
 int flash_key_write (uint8_t *key_addr,
 		     const uint8_t *key_data, int key_data_len,
 		     const uint8_t *pubkey, int pubkey_len);
@@ -155,6 +162,9 @@ void flash_increment_counter (uint8_t counter_tag_nr);
 void flash_reset_counter (uint8_t counter_tag_nr);
 void flash_read_selected_identity(void);
 void flash_set_identity(uint8_t id);
+#ifdef GNU_LINUX_EMULATION
+int flash_data_pool_erase_count (int i);
+#endif
 
 #define FILEID_SERIAL_NO	0
 #define FILEID_UPDATE_KEY_0	1
@@ -178,12 +188,23 @@ uint8_t* flash_get_ch_cert_start(void);
 #define DATA_ENCRYPTION_KEY_SIZE 16
 
 #define MAX_PRVKEY_LEN 512	/* Maximum is the case for RSA 4096-bit.  */
+#define MAX_RSA_CRT_LEN (MAX_PRVKEY_LEN / 2 * 3) /* dP, dQ and qInv */
 
 struct key_data {
   const uint8_t *pubkey;	/* Pointer to public key */
   uint8_t data[MAX_PRVKEY_LEN]; /* decrypted private key data content */
 };
 
+/*
+ * CRT parameters (dP, dQ and qInv) of an RSA private key.  It is
+ * shared by keys, and only KD has valid parameters (none, if NULL).
+ */
+struct rsa_crt {
+  const struct key_data *kd;
+  uint32_t data[MAX_RSA_CRT_LEN / sizeof (uint32_t)];
+};
+extern struct rsa_crt rsa_crt;
+
 struct prvkey_data {
   /*
    * IV: Initial Vector
@@ -201,6 +222,14 @@ struct prvkey_data {
   uint8_t dek_encrypted_3[DATA_ENCRYPTION_KEY_SIZE]; /* For admin */
 };
 
+/*
+ * An RSA private key may be stored with its CRT parameters (dP, dQ and
+ * qInv), encrypted after the public key in the key storage.  The DO
+ * of such a key has this byte after struct prvkey_data.
+ */
+#define PRVKEY_FORMAT_RSA_CRT 0x01
+#define PRVKEY_DO_MAX_LEN (sizeof (struct prvkey_data) + 1)
+
 #define BY_USER		1
 #define BY_RESETCODE	2
 #define BY_ADMIN	3
@@ -265,6 +294,9 @@ void put_binary (const char *s, int len);
 #define DEBUG_BINARY(s,len)
 #endif
 
+int rsa_crt_compute (const uint8_t *, int, uint8_t *);
+int rsa_crt_precompute (const struct key_data *, int);
+void rsa_crt_clear (void);
 int rsa_sign (const uint8_t *, uint8_t *, int, struct key_data *, int);
 int modulus_calc (const uint8_t *, int, uint8_t *);
 int rsa_decrypt (const uint8_t *, uint8_t *, int, struct key_data *,
@@ -272,15 +304,20 @@ int rsa_decrypt (const uint8_t *, uint8_t *, int, struct key_data *,
 int rsa_verify (const uint8_t *, int, const uint8_t *, const uint8_t *);
 int rsa_genkey (int, uint8_t *, uint8_t *);
 
+#define ECDSA_NONCE_RANDOM        0
+#define ECDSA_NONCE_DETERMINISTIC 1 /* RFC 6979 */
+#define ECDSA_NONCE_HEDGED        2 /* RFC 6979 with additional entropy */
+int gpg_do_get_ecdsa_nonce (enum kind_of_key kk);
+
 int ecdsa_sign_p256r1 (const uint8_t *hash, uint8_t *output,
-		       const uint8_t *key_data);
+		       const uint8_t *key_data, int nonce_mode);
 int ecc_compute_public_p256r1 (const uint8_t *key_data, uint8_t *);
 int ecc_check_secret_p256r1 (const uint8_t *d0, uint8_t *d1);
 int ecdh_decrypt_p256r1 (const uint8_t *input, uint8_t *output,
 			 const uint8_t *key_data);
 
 int ecdsa_sign_p256k1 (const uint8_t *hash, uint8_t *output,
-		       const uint8_t *key_data);
+		       const uint8_t *key_data, int nonce_mode);
 int ecc_compute_public_p256k1 (const uint8_t *key_data, uint8_t *);
 int ecc_check_secret_p256k1 (const uint8_t *d0, uint8_t  *d1);
 int ecdh_decrypt_p256k1 (const uint8_t *input, uint8_t *output,
@@ -393,7 +430,15 @@ extern uint8_t admin_authorized;
 #define NR_DO_UIF_DEC		0xf7
 #define NR_DO_UIF_AUT		0xf8
 /*
- * NR_UINT_SOMETHING could be here...  Use 0xf[459abcd]
+ * Representation of ECDSA nonce generation:
+ *  All keys random:             0xf400 or No record in flash memory
+ *  Otherwise:                   0xf4??
+ *                    where <??> has two bits for each key (ECDSA_NONCE_*),
+ *                    at bit 0-1 (signature) and bit 4-5 (authentication)
+ */
+#define NR_DO_ECDSA_NONCE	0xf4
+/*
+ * NR_UINT_SOMETHING could be here...  Use 0xf[59abcd]
  */
 /* 123-counters: Recorded in flash memory by 2-halfword (4-byte).  */
 /*
@@ -12,3 +12,5 @@ void jpc_double_p256r1 (jpc *X, const jpc *A);
 void jpc_add_ac_p256r1 (jpc *X, const jpc *A, const ac *B);
 void jpc_add_ac_signed_p256r1 (jpc *X, const jpc *A, const ac *B, int minus);
 int jpc_to_ac_p256r1 (ac *X, const jpc *A);
+int jpc_to_ac_vartime_p256r1 (ac *X, const jpc *A);
+int jpc_to_ac_multi_vartime_p256r1 (ac *X, const jpc *A, int n);
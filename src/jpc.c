@@ -171,29 +171,97 @@ FUNC(jpc_add_ac) (jpc *X, const jpc *A, const ac *B)
   FUNC(jpc_add_ac_signed) (X, A, B, 0);
 }
 
+static void
+jpc_to_ac_z_inv (ac *X, const jpc *A, bn256 *z_inv)
+{
+  bn256 z_inv_sqr[1];
+
+  MFNC(sqr) (z_inv_sqr, z_inv);
+  MFNC(mul) (z_inv, z_inv, z_inv_sqr);
+
+  MFNC(mul) (X->x, A->x, z_inv_sqr);
+  MFNC(mul) (X->y, A->y, z_inv);
+}
+
 /**
  * @brief	X = convert A
  *
  * @param X	Destination AC
  * @param A	JPC
  *
+ * A may depend on secret (result of scalar multiplication by secret),
+ * so, inverse is computed in constant time.
+ *
  * Return -1 on error (infinite).
  * Return 0 on success.
  */
 int
 FUNC(jpc_to_ac) (ac *X, const jpc *A)
 {
-  bn256 z_inv[1], z_inv_sqr[1];
+  bn256 z_inv[1];
 
   if (bn256_is_zero (A->z))
     return -1;
 
   mod_inv (z_inv, A->z, CONST_P256);
+  jpc_to_ac_z_inv (X, A, z_inv);
+  return 0;
+}
 
-  MFNC(sqr) (z_inv_sqr, z_inv);
-  MFNC(mul) (z_inv, z_inv, z_inv_sqr);
+/**
+ * @brief	X = convert A, where A is public
+ *
+ * Same as jpc_to_ac, but inverse is computed in variable time.
+ * Only for A which is computed from public values.
+ */
+int
+FUNC(jpc_to_ac_vartime) (ac *X, const jpc *A)
+{
+  bn256 z_inv[1];
 
-  MFNC(mul) (X->x, A->x, z_inv_sqr);
-  MFNC(mul) (X->y, A->y, z_inv);
+  if (bn256_is_zero (A->z))
+    return -1;
+
+  mod_inv_vartime (z_inv, A->z, CONST_P256);
+  jpc_to_ac_z_inv (X, A, z_inv);
+  return 0;
+}
+
+/**
+ * @brief	X[i] = convert A[i], for 0 <= i < N, where A[i] are public
+ *
+ * @param X	Array of destination AC
+ * @param A	Array of JPC
+ * @param N	Number of points
+ *
+ * By Montgomery's trick, only a single inverse is computed for N
+ * points, at the cost of 3*(N-1) multiplications.  The partial
+ * products of Z are kept in X[i].x in the meantime.  Inverse is
+ * computed in variable time, so, only for A[i] from public values.
+ *
+ * Return -1 on error (any of A[i] is infinite).
+ * Return 0 on success.
+ */
+int
+FUNC(jpc_to_ac_multi_vartime) (ac *X, const jpc *A, int n)
+{
+  bn256 inv[1], z_inv[1];
+  int i;
+
+  memcpy (X[0].x, A[0].z, sizeof (bn256));
+  for (i = 1; i < n; i++)
+    MFNC(mul) (X[i].x, X[i-1].x, A[i].z);
+
+  if (bn256_is_zero (X[n-1].x))
+    return -1;
+
+  mod_inv_vartime (inv, X[n-1].x, CONST_P256);
+  for (i = n - 1; i > 0; i--)
+    {
+      MFNC(mul) (z_inv, inv, X[i-1].x);
+      MFNC(mul) (inv, inv, A[i].z);
+      jpc_to_ac_z_inv (&X[i], &A[i], z_inv);
+    }
+  jpc_to_ac_z_inv (&X[0], &A[0], inv);
   return 0;
 }
@@ -51,32 +51,38 @@
 #define LED_TIMEOUT_ONE		(100*1000)
 #define LED_TIMEOUT_STOP	(200*1000)
 
-#ifdef DFU_SUPPORT
-static int
-flash_write_any (uintptr_t dst_addr, const uint8_t *src, size_t len)
+#ifdef GNU_LINUX_EMULATION
+uint8_t *flash_addr_key_storage_start;
+uint8_t *flash_addr_data_storage_start;
+
+/*
+ * Flash endurance simulation: increment the digital signature counter
+ * COUNT times on the flash image, and report erase count of each page
+ * of data pool.  It modifies the image; Use a copy for it.
+ */
+static void
+flash_endurance_test (long count)
 {
-  int status;
+  const uint8_t *do_start, *do_end;
+  long i;
+  int n;
 
-  while (len)
+  flash_do_storage_init (&do_start, &do_end);
+  if (do_start == NULL)
     {
-      uint16_t hw = *src++;
-
-      hw |= (*src++ << 8);
-      status = flash_program_halfword (dst_addr, hw);
-      if (status != 0)
-        return 0;              /* error return */
-
-      dst_addr += 2;
-      len -= 2;
+      fprintf (stderr, "Card is terminated\n");
+      exit (1);
     }
 
-  return 1;
-}
-#endif
+  gpg_data_scan (do_start, do_end);
+  for (i = 0; i < count; i++)
+    gpg_increment_digital_signature_counter ();
 
-#ifdef GNU_LINUX_EMULATION
-uint8_t *flash_addr_key_storage_start;
-uint8_t *flash_addr_data_storage_start;
+  fprintf (stdout, "%ld signatures, erase count of data pool pages:", count);
+  for (i = 0; (n = flash_data_pool_erase_count (i)) >= 0; i++)
+    fprintf (stdout, " %d", n);
+  fprintf (stdout, "\n");
+}
 #else
 #define ID_OFFSET (2+SERIALNO_STR_LEN*2)
 static void
@@ -131,14 +137,14 @@ device_initialize_once (void)
 
         /* Copy SYS */
         addr = ORIGIN_REAL;
-        flash_write_any(addr, &_binary_build_stdaln_sys_bin_start,
-                        stdaln_sys_size);
+        flash_program_buffer(addr, &_binary_build_stdaln_sys_bin_start,
+                             stdaln_sys_size);
         addr += stdaln_sys_size;
-        flash_write_any(addr, (const uint8_t *) &FT0, sizeof(FT0));
+        flash_program_buffer(addr, (const uint8_t *) &FT0, sizeof(FT0));
         addr += sizeof(FT0);
-        flash_write_any(addr, (const uint8_t *) &FT1, sizeof(FT1));
+        flash_program_buffer(addr, (const uint8_t *) &FT1, sizeof(FT1));
         addr += sizeof(FT1);
-        flash_write_any(addr, (const uint8_t *) &FT2, sizeof(FT2));
+        flash_program_buffer(addr, (const uint8_t *) &FT2, sizeof(FT2));
 
         addr = ORIGIN_REAL + 0x1000;
         if (addr < ORIGIN) {
@@ -303,6 +309,7 @@ main (int argc, const char *argv[])
   uintptr_t flash_addr;
   const char *flash_image_path;
   char *path_string = NULL;
+  long flash_endurance = 0;
 #endif
 #ifdef FLASH_UPGRADE_SUPPORT
   uintptr_t entry;
@@ -320,11 +327,19 @@ main (int argc, const char *argv[])
 
   if (argc >= 4 || (argc == 2 && !strcmp (argv[1], "--help")))
     {
-      fprintf (stdout, "Usage: %s [--vidpid=Vxxx:Pxxx] [flash-image-file]",
-	       argv[0]);
+      fprintf (stdout, "Usage: %s [--vidpid=Vxxx:Pxxx] [flash-image-file]\n"
+	       "       %s --flash-endurance=COUNT flash-image-file",
+	       argv[0], argv[0]);
       exit (0);
     }
 
+  if (argc >= 2 && !strncmp (argv[1], "--flash-endurance=", 18))
+    {
+      flash_endurance = strtol (&argv[1][18], NULL, 10);
+      argc--;
+      argv++;
+    }
+
   if (argc >= 2 && !strncmp (argv[1], "--debug=", 8))
     {
       debug = strtol (&argv[1][8], NULL, 10);
@@ -386,6 +401,12 @@ main (int argc, const char *argv[])
 #ifdef GNU_LINUX_EMULATION
     if (path_string)
       free (path_string);
+
+    if (flash_endurance)
+      {
+	flash_endurance_test (flash_endurance);
+	exit (0);
+      }
 #else
   device_initialize_once ();
 #endif
@@ -132,221 +132,373 @@ mod_reduce (bn256 *X, const bn512 *A, const bn256 *B, const bn256 *MU_lower)
 }
 
 /*
+ * Modular inversion by "safegcd" (divsteps).
+ *
  * Reference:
- * Donald E. Knuth, The Art of Computer Programming, Vol. 2:
- * Seminumerical Algorithms, 3rd ed. Reading, MA: Addison-Wesley, 1998
+ * Daniel J. Bernstein and Bo-Yin Yang, Fast constant-time gcd
+ * computation and modular inversion, 2019.
  *
- * Max loop: X=0x8000...0000 and N=0xffff...ffff
+ * Numbers are represented by nine signed limbs of 30-bit, so that
+ * 30 divsteps can be done at once on the lowest limbs, and then
+ * applied to the whole numbers by a 2x2 matrix.
  */
-#define MAX_GCD_STEPS_BN256 (3*256-2)
+typedef struct {
+  int32_t v[9];
+} s30;
+
+typedef struct {
+  int32_t u, v, q, r;
+} trans2x2;
+
+#define M30 ((int32_t)0x3fffffff)
+
+static void
+s30_from_bn256 (s30 *r, const bn256 *a)
+{
+  int i;
+
+  for (i = 0; i < 9; i++)
+    {
+      int b = i * 30;
+      uint64_t w = a->word[b / 32];
+
+      if (b / 32 + 1 < BN256_WORDS)
+	w |= (uint64_t)a->word[b / 32 + 1] << 32;
+      r->v[i] = (int32_t)(w >> (b % 32)) & M30;
+    }
+}
+
+static void
+s30_to_bn256 (bn256 *X, const s30 *a)
+{
+  int i;
+
+  memset (X, 0, sizeof (bn256));
+  for (i = 0; i < 9; i++)
+    {
+      int b = i * 30;
+      uint32_t w = (uint32_t)a->v[i];
+
+      X->word[b / 32] |= w << (b % 32);
+      if (b % 32 > 2 && b / 32 + 1 < BN256_WORDS)
+	X->word[b / 32 + 1] |= w >> (32 - b % 32);
+    }
+}
+
+/*
+ * 30 divsteps in constant time, on the lowest limbs F0 and G0.
+ * ZETA is -(delta+1/2).  T is the transition matrix, scaled by 2^30.
+ */
+static int32_t
+divsteps_30 (int32_t zeta, uint32_t f0, uint32_t g0, trans2x2 *t)
+{
+  uint32_t u = 1, v = 0, q = 0, r = 1;
+  uint32_t f = f0, g = g0;
+  uint32_t c1, c2, x, y, z;
+  int i;
+
+  for (i = 0; i < 30; i++)
+    {
+      c1 = (uint32_t)(zeta >> 31);	/* All ones when zeta < 0 */
+      c2 = -(g & 1);			/* All ones when g is odd */
+      x = (f ^ c1) - c1;
+      y = (u ^ c1) - c1;
+      z = (v ^ c1) - c1;
+      g += x & c2;
+      q += y & c2;
+      r += z & c2;
+      c1 &= c2;
+      zeta = (zeta ^ (int32_t)c1) - 1;
+      f += g & c1;
+      u += q & c1;
+      v += r & c1;
+      g >>= 1;
+      u <<= 1;
+      v <<= 1;
+    }
+
+  t->u = (int32_t)u;
+  t->v = (int32_t)v;
+  t->q = (int32_t)q;
+  t->r = (int32_t)r;
+  return zeta;
+}
+
+/*
+ * 30 divsteps in variable time.  ETA is -delta.
+ */
+static int32_t
+divsteps_30_vartime (int32_t eta, uint32_t f0, uint32_t g0, trans2x2 *t)
+{
+  uint32_t u = 1, v = 0, q = 0, r = 1;
+  uint32_t f = f0, g = g0;
+  uint32_t m, w, f_inv;
+  int i = 30, limit, zeros;
+
+  while (1)
+    {
+      /* Skip zeros at once, up to I, with a sentinel bit.  */
+      zeros = __builtin_ctz (g | (0xffffffffU << i));
+      g >>= zeros;
+      u <<= zeros;
+      v <<= zeros;
+      eta -= zeros;
+      i -= zeros;
+      if (i == 0)
+	break;
+
+      /* G is odd now.  If eta < 0, replace (F, G) by (G, -F).  */
+      if (eta < 0)
+	{
+	  uint32_t tmp;
+
+	  eta = -eta;
+	  tmp = f;  f = g;  g = -tmp;
+	  tmp = u;  u = q;  q = -tmp;
+	  tmp = v;  v = r;  r = -tmp;
+	}
+
+      /* Cancel up to min(eta+1, i, 8) lowest bits of G by adding W*F.  */
+      limit = (eta + 1) > i ? i : (eta + 1);
+      m = (0xffffffffU >> (32 - limit)) & 255;
+      f_inv = f;			/* Correct for 3 bits, as F is odd */
+      f_inv *= 2 - f * f_inv;		/* 6 bits */
+      f_inv *= 2 - f * f_inv;		/* 12 bits */
+      w = (g * -f_inv) & m;
+      g += f * w;
+      q += u * w;
+      r += v * w;
+    }
+
+  t->u = (int32_t)u;
+  t->v = (int32_t)v;
+  t->q = (int32_t)q;
+  t->r = (int32_t)r;
+  return eta;
+}
+
+/*
+ * [D, E] := T * [D, E] / 2^30 mod N
+ *
+ * D and E should be in (-2N, N), and so are the results.
+ */
+static void
+update_de_30 (s30 *d, s30 *e, const trans2x2 *t,
+	      const s30 *n, uint32_t n_inv30)
+{
+  const int32_t u = t->u, v = t->v, q = t->q, r = t->r;
+  int32_t di, ei, md, me, sd, se;
+  int64_t cd, ce;
+  int i;
+
+  /* Add N*[u, q] when D < 0, and N*[v, r] when E < 0.  */
+  sd = d->v[8] >> 31;
+  se = e->v[8] >> 31;
+  md = (u & sd) + (v & se);
+  me = (q & sd) + (r & se);
+
+  di = d->v[0];
+  ei = e->v[0];
+  cd = (int64_t)u * di + (int64_t)v * ei;
+  ce = (int64_t)q * di + (int64_t)r * ei;
+
+  /* Adjust MD and ME, so that the lowest 30 bits become zero.  */
+  md -= (n_inv30 * (uint32_t)cd + md) & M30;
+  me -= (n_inv30 * (uint32_t)ce + me) & M30;
+
+  cd += (int64_t)n->v[0] * md;
+  ce += (int64_t)n->v[0] * me;
+  cd >>= 30;
+  ce >>= 30;
+
+  for (i = 1; i < 9; i++)
+    {
+      di = d->v[i];
+      ei = e->v[i];
+      cd += (int64_t)u * di + (int64_t)v * ei;
+      ce += (int64_t)q * di + (int64_t)r * ei;
+      cd += (int64_t)n->v[i] * md;
+      ce += (int64_t)n->v[i] * me;
+      d->v[i - 1] = (int32_t)cd & M30;
+      e->v[i - 1] = (int32_t)ce & M30;
+      cd >>= 30;
+      ce >>= 30;
+    }
+
+  d->v[8] = (int32_t)cd;
+  e->v[8] = (int32_t)ce;
+}
+
+/*
+ * [F, G] := T * [F, G] / 2^30
+ */
+static void
+update_fg_30 (s30 *f, s30 *g, const trans2x2 *t)
+{
+  const int32_t u = t->u, v = t->v, q = t->q, r = t->r;
+  int32_t fi, gi;
+  int64_t cf, cg;
+  int i;
+
+  fi = f->v[0];
+  gi = g->v[0];
+  cf = (int64_t)u * fi + (int64_t)v * gi;
+  cg = (int64_t)q * fi + (int64_t)r * gi;
+  cf >>= 30;
+  cg >>= 30;
+
+  for (i = 1; i < 9; i++)
+    {
+      fi = f->v[i];
+      gi = g->v[i];
+      cf += (int64_t)u * fi + (int64_t)v * gi;
+      cg += (int64_t)q * fi + (int64_t)r * gi;
+      f->v[i - 1] = (int32_t)cf & M30;
+      g->v[i - 1] = (int32_t)cg & M30;
+      cf >>= 30;
+      cg >>= 30;
+    }
+
+  f->v[8] = (int32_t)cf;
+  g->v[8] = (int32_t)cg;
+}
+
+/*
+ * Bring R in (-2N, N) to [0, N), negating it when SIGN < 0.
+ */
+static void
+normalize_30 (s30 *r, int32_t sign, const s30 *n)
+{
+  int32_t cond;
+  int i;
+
+  cond = r->v[8] >> 31;
+  for (i = 0; i < 9; i++)
+    r->v[i] += n->v[i] & cond;
+
+  cond = sign >> 31;
+  for (i = 0; i < 9; i++)
+    r->v[i] = (r->v[i] ^ cond) - cond;
+
+  for (i = 0; i < 8; i++)
+    {
+      r->v[i + 1] += r->v[i] >> 30;
+      r->v[i] &= M30;
+    }
+
+  cond = r->v[8] >> 31;
+  for (i = 0; i < 9; i++)
+    r->v[i] += n->v[i] & cond;
+
+  for (i = 0; i < 8; i++)
+    {
+      r->v[i + 1] += r->v[i] >> 30;
+      r->v[i] &= M30;
+    }
+}
+
+/* N^(-1) mod 2^30, for odd N */
+static uint32_t
+inv30 (const bn256 *N)
+{
+  uint32_t n0 = N->word[0];
+  uint32_t x = n0;		/* Correct for 3 bits */
+
+  x *= 2 - n0 * x;		/* 6 bits */
+  x *= 2 - n0 * x;		/* 12 bits */
+  x *= 2 - n0 * x;		/* 24 bits */
+  x *= 2 - n0 * x;		/* 48 bits */
+  return x & M30;
+}
+
+/*
+ * 20 iterations of 30 divsteps; 590 divsteps are enough for 256-bit.
+ */
+#define MAX_DIVSTEPS_ITER_BN256 20
 
 /**
  * @brief C = X^(-1) mod N
  *
- * Assume X and N are co-prime (or N is prime).
+ * Constant time.  Use this when X is secret.
+ *
+ * Assume X and N are co-prime (or N is prime), and N is odd.
  * NOTE: If X==0, it return 0.
  *
  */
 void
 mod_inv (bn256 *C, const bn256 *X, const bn256 *N)
 {
-  bn256 u[1], v[1], tmp[1];
-  bn256 A[1] = { { { 1, 0, 0, 0, 0, 0, 0, 0 } } };
-  uint32_t carry;
-#define borrow carry
-  int n = MAX_GCD_STEPS_BN256;
+  s30 d[1], e[1], f[1], g[1], n[1];
+  trans2x2 t[1];
+  uint32_t n_inv30 = inv30 (N);
+  int32_t zeta = -1;		/* delta = 1/2 */
+  int i;
+
+  memset (d, 0, sizeof (s30));
+  memset (e, 0, sizeof (s30));
+  e->v[0] = 1;
+  s30_from_bn256 (n, N);
+  memcpy (f, n, sizeof (s30));
+  s30_from_bn256 (g, X);
+
+  for (i = 0; i < MAX_DIVSTEPS_ITER_BN256; i++)
+    {
+      zeta = divsteps_30 (zeta, f->v[0], g->v[0], t);
+      update_de_30 (d, e, t, n, n_inv30);
+      update_fg_30 (f, g, t);
+    }
+
+  /* F is +1 or -1 now, and D is the inverse multiplied by F.  */
+  normalize_30 (d, f->v[8], n);
+  s30_to_bn256 (C, d);
 
-  memset (tmp, 0, sizeof (bn256));
-  memset (C, 0, sizeof (bn256));
-  memcpy (u, X, sizeof (bn256));
-  memcpy (v, N, sizeof (bn256));
+  memset (d, 0, sizeof (s30));
+  memset (e, 0, sizeof (s30));
+  memset (f, 0, sizeof (s30));
+  memset (g, 0, sizeof (s30));
+  memset (t, 0, sizeof (trans2x2));
+}
 
-  while (n--)
+/**
+ * @brief C = X^(-1) mod N
+ *
+ * Variable time, it stops when the GCD is found.  Use this only
+ * when X is public.
+ *
+ * Assume X and N are co-prime (or N is prime), and N is odd.
+ * NOTE: If X==0, it return 0.
+ *
+ */
+void
+mod_inv_vartime (bn256 *C, const bn256 *X, const bn256 *N)
+{
+  s30 d[1], e[1], f[1], g[1], n[1];
+  trans2x2 t[1];
+  uint32_t n_inv30 = inv30 (N);
+  int32_t eta = -1;		/* delta = 1 */
+  int i;
+
+  memset (d, 0, sizeof (s30));
+  memset (e, 0, sizeof (s30));
+  e->v[0] = 1;
+  s30_from_bn256 (n, N);
+  memcpy (f, n, sizeof (s30));
+  s30_from_bn256 (g, X);
+
+  while (1)
     {
-      int c = (bn256_is_even (u) << 1) + bn256_is_even (v);
+      int32_t nonzero = 0;
 
-      switch (c)
-	{
-	case 3:
-	  bn256_shift (u, u, -1);
-	  if (bn256_is_even (A))
-	    {
-	      bn256_add (tmp, A, N);
-	      carry = 0;
-	    }
-	  else
-	    carry = bn256_add (A, A, N);
-
-	  bn256_shift (A, A, -1);
-	  A->word[7] |= carry * 0x80000000;
-
-	  bn256_shift (v, v, -1);
-	  if (bn256_is_even (C))
-	    {
-	      bn256_add (tmp, C, N);
-	      carry = 0;
-	    }
-	  else
-	    carry = bn256_add (C, C, N);
-
-	  bn256_shift (C, C, -1);
-	  C->word[7] |= carry * 0x80000000;
-
-	  if (bn256_is_ge (tmp, tmp))
-	    {
-	      bn256_sub (tmp, tmp, tmp);
-	      borrow = bn256_sub (tmp, tmp, tmp);
-	      if (borrow)
-		bn256_add (tmp, tmp, tmp);
-	      else
-		bn256_add (tmp, A, N);
-	    }
-	  else
-	    {
-	      bn256_sub (tmp, tmp, tmp);
-	      borrow = bn256_sub (tmp, tmp, tmp);
-	      if (borrow)
-		bn256_add (tmp, tmp, tmp);
-	      else
-		bn256_add (tmp, tmp, N);
-	    }
-	  break;
-
-	case 1:
-	  bn256_shift (tmp, tmp, -1);
-	  if (bn256_is_even (tmp))
-	    {
-	      bn256_add (tmp, tmp, N);
-	      carry = 0;
-	    }
-	  else
-	    carry = bn256_add (tmp, tmp, N);
-
-	  bn256_shift (tmp, tmp, -1);
-	  tmp->word[7] |= carry * 0x80000000;
-
-	  bn256_shift (v, v, -1);
-	  if (bn256_is_even (C))
-	    {
-	      bn256_add (tmp, C, N);
-	      carry = 0;
-	    }
-	  else
-	    carry = bn256_add (C, C, N);
-
-	  bn256_shift (C, C, -1);
-	  C->word[7] |= carry * 0x80000000;
-
-	  if (bn256_is_ge (tmp, tmp))
-	    {
-	      bn256_sub (tmp, tmp, tmp);
-	      borrow = bn256_sub (tmp, tmp, tmp);
-	      if (borrow)
-		bn256_add (tmp, tmp, tmp);
-	      else
-		bn256_add (tmp, A, N);
-	    }
-	  else
-	    {
-	      bn256_sub (tmp, tmp, tmp);
-	      borrow = bn256_sub (tmp, tmp, tmp);
-	      if (borrow)
-		bn256_add (tmp, tmp, tmp);
-	      else
-		bn256_add (tmp, tmp, N);
-	    }
-	  break;
-
-	case 2:
-	  bn256_shift (u, u, -1);
-	  if (bn256_is_even (A))
-	    {
-	      bn256_add (tmp, A, N);
-	      carry = 0;
-	    }
-	  else
-	    carry = bn256_add (A, A, N);
-
-	  bn256_shift (A, A, -1);
-	  A->word[7] |= carry * 0x80000000;
-
-	  bn256_shift (tmp, tmp, -1);
-	  if (bn256_is_even (tmp))
-	    {
-	      bn256_add (tmp, tmp, N);
-	      carry = 0;
-	    }
-	  else
-	    carry = bn256_add (tmp, tmp, N);
-
-	  bn256_shift (tmp, tmp, -1);
-	  tmp->word[7] |= carry * 0x80000000;
-
-	  if (bn256_is_ge (tmp, tmp))
-	    {
-	      bn256_sub (tmp, tmp, tmp);
-	      borrow = bn256_sub (tmp, tmp, tmp);
-	      if (borrow)
-		bn256_add (tmp, tmp, tmp);
-	      else
-		bn256_add (tmp, A, N);
-	    }
-	  else
-	    {
-	      bn256_sub (tmp, tmp, tmp);
-	      borrow = bn256_sub (tmp, tmp, tmp);
-	      if (borrow)
-		bn256_add (tmp, tmp, tmp);
-	      else
-		bn256_add (tmp, tmp, N);
-	    }
-	  break;
-
-	case 0:
-	  bn256_shift (tmp, tmp, -1);
-	  if (bn256_is_even (tmp))
-	    {
-	      bn256_add (tmp, tmp, N);
-	      carry = 0;
-	    }
-	  else
-	    carry = bn256_add (tmp, tmp, N);
-
-	  bn256_shift (tmp, tmp, -1);
-	  tmp->word[7] |= carry * 0x80000000;
-
-	  bn256_shift (tmp, tmp, -1);
-	  if (bn256_is_even (tmp))
-	    {
-	      bn256_add (tmp, tmp, N);
-	      carry = 0;
-	    }
-	  else
-	    carry = bn256_add (tmp, tmp, N);
-
-	  bn256_shift (tmp, tmp, -1);
-	  tmp->word[7] |= carry * 0x80000000;
-
-	  if (bn256_is_ge (u, v))
-	    {
-	      bn256_sub (u, u, v);
-	      borrow = bn256_sub (A, A, C);
-	      if (borrow)
-		bn256_add (A, A, N);
-	      else
-		bn256_add (tmp, A, N);
-	    }
-	  else
-	    {
-	      bn256_sub (v, v, u);
-	      borrow = bn256_sub (C, C, A);
-	      if (borrow)
-		bn256_add (C, C, N);
-	      else
-		bn256_add (tmp, C, N);
-	    }
-	  break;
-	}
+      eta = divsteps_30_vartime (eta, f->v[0], g->v[0], t);
+      update_de_30 (d, e, t, n, n_inv30);
+      update_fg_30 (f, g, t);
+
+      for (i = 0; i < 9; i++)
+	nonzero |= g->v[i];
+      if (!nonzero)
+	break;
     }
-#undef borrow
+
+  normalize_30 (d, f->v[8], n);
+  s30_to_bn256 (C, d);
 }
@@ -34,13 +34,28 @@
 #include "polarssl/config.h"
 #include "polarssl/aes.h"
 #include "sha512.h"
+#include "gnuk-malloc.h"
 
 /* Forward declaration */
 #define CLEAN_PAGE_FULL 1
 #define CLEAN_SINGLE    0
 static void gpg_do_delete_prvkey (enum kind_of_key kk, int clean_page_full);
+static int prvkey_rsa_crt_stored (enum kind_of_key kk);
 static void gpg_reset_digital_signature_counter (void);
 
+/*
+ * Generation of data objects, bumped on any change which may affect
+ * the serialization of Application Related Data (see below), and by
+ * flash_copying_gc.  Starts at 1, so that the cache is empty at boot.
+ */
+static uint32_t do_generation = 1;
+
+void
+gpg_do_bump_generation (void)
+{
+  do_generation++;
+}
+
 #define PASSWORD_ERRORS_MAX 3	/* >= errors, it will be locked */
 static const uint8_t *pw_err_counter_p[3];
 
@@ -73,6 +88,7 @@ gpg_pw_locked (uint8_t which)
 void
 gpg_pw_reset_err_counter (uint8_t which)
 {
+  gpg_do_bump_generation ();
   flash_cnt123_clear (&pw_err_counter_p[which]);
   if (pw_err_counter_p[which] != NULL)
     GPG_MEMORY_FAILURE ();
@@ -81,6 +97,7 @@ gpg_pw_reset_err_counter (uint8_t which)
 void
 gpg_pw_increment_err_counter (uint8_t which)
 {
+  gpg_do_bump_generation ();
   flash_cnt123_increment (which, &pw_err_counter_p[which]);
 }
 
@@ -98,9 +115,9 @@ const uint8_t historical_bytes[] __attribute__ ((aligned (1))) = {
   0x00,
   0x31, 0x84,			/* Full DF name, GET DATA, MF */
   0x73,
-  0x80, 0x01, 0x80,		/* Full DF name */
+  0x80, 0x01, 0xc0,		/* Full DF name */
 				/* 1-byte */
-				/* Command chaining, No extended Lc and Le */
+				/* Command chaining, Extended Lc and Le */
 #ifdef LIFE_CYCLE_MANAGEMENT_SUPPORT
   0x05,
 #else
@@ -130,9 +147,9 @@ static const uint8_t extended_capabilities[] __attribute__ ((aligned (1))) = {
   0x00, 0x00,
 #endif
   /* Max. length of command APDU data */
-  0x00, 0xff,
+  (MAX_CMD_APDU_DATA_SIZE >> 8), (MAX_CMD_APDU_DATA_SIZE & 0xff),
   /* Max. length of response APDU data */
-  0x01, 0x00,
+  (MAX_RES_APDU_DATA_SIZE >> 8), (MAX_RES_APDU_DATA_SIZE & 0xff),
 };
 
 #ifdef ACKBTN_SUPPORT
@@ -318,7 +335,7 @@ gpg_get_algo_attr_key_size (enum kind_of_key kk, enum size_of_key s)
     {
     case ALGO_RSA4K:
       if (s == GPG_KEY_STORAGE)
-	return 1024;
+	return prvkey_rsa_crt_stored (kk) ? 2048 : 1024;
       else
 	return 512;
     case ALGO_NISTP256R1:
@@ -344,7 +361,7 @@ gpg_get_algo_attr_key_size (enum kind_of_key kk, enum size_of_key s)
     default:
     rsa2k:
       if (s == GPG_KEY_STORAGE)
-	return 512;
+	return prvkey_rsa_crt_stored (kk) ? 1024 : 512;
       else
 	return 256;
     }
@@ -391,6 +408,9 @@ gpg_increment_digital_signature_counter (void)
   uint16_t hw0, hw1;
   uint32_t dsc = (digital_signature_counter + 1) & 0x00ffffff;
 
+  /* Update it first, as copying GC may occur on writing below.  */
+  digital_signature_counter = dsc;
+
   if ((dsc & 0x03ff) == 0)
     { /* carry occurs from l10 to h14 */
       hw0 = NR_COUNTER_DS | ((dsc & 0xfc0000) >> 18) | ((dsc & 0x03fc00) >> 2);
@@ -404,8 +424,6 @@ gpg_increment_digital_signature_counter (void)
       flash_put_data (hw1);
     }
 
-  digital_signature_counter = dsc;
-
   if (gpg_get_pw1_lifetime () == 0)
     ac_reset_pso_cds ();
 }
@@ -465,6 +483,7 @@ static const struct do_table_entry *get_do_entry (uint16_t tag);
 #define GPG_DO_UIF_SIG		0x00d6
 #define GPG_DO_UIF_DEC		0x00d7
 #define GPG_DO_UIF_AUT		0x00d8
+#define GPG_DO_ECDSA_NONCE	0x00f4 /* Gnuk specific */
 #define GPG_DO_KDF		0x00f9
 #define GPG_DO_KEY_IMPORT	0x3fff
 #define GPG_DO_LANGUAGE		0x5f2d
@@ -476,46 +495,6 @@ static const struct do_table_entry *get_do_entry (uint16_t tag);
 
 static const uint8_t *do_ptr[NR_DO__LAST__];
 
-static int
-do_tag_to_nr (uint16_t tag)
-{
-  switch (tag)
-    {
-    case GPG_DO_SEX:
-      return NR_DO_SEX;
-    case GPG_DO_FP_SIG:
-      return NR_DO_FP_SIG;
-    case GPG_DO_FP_DEC:
-      return NR_DO_FP_DEC;
-    case GPG_DO_FP_AUT:
-      return NR_DO_FP_AUT;
-    case GPG_DO_CAFP_1:
-      return NR_DO_CAFP_1;
-    case GPG_DO_CAFP_2:
-      return NR_DO_CAFP_2;
-    case GPG_DO_CAFP_3:
-      return NR_DO_CAFP_3;
-    case GPG_DO_KGTIME_SIG:
-      return NR_DO_KGTIME_SIG;
-    case GPG_DO_KGTIME_DEC:
-      return NR_DO_KGTIME_DEC;
-    case GPG_DO_KGTIME_AUT:
-      return NR_DO_KGTIME_AUT;
-    case GPG_DO_LOGIN_DATA:
-      return NR_DO_LOGIN_DATA;
-    case GPG_DO_URL:
-      return NR_DO_URL;
-    case GPG_DO_NAME:
-      return NR_DO_NAME;
-    case GPG_DO_LANGUAGE:
-      return NR_DO_LANGUAGE;
-    case GPG_DO_KDF:
-      return NR_DO_KDF;
-    default:
-      return -1;
-    }
-}
-
 static void
 copy_tag (uint16_t tag)
 {
@@ -875,6 +854,68 @@ rw_uif (uint16_t tag, int with_tag, const uint8_t *data, int len, int is_write)
 #endif
 
 
+/*
+ * ECDSA nonce generation, for each key.  One byte, two bits for each
+ * key: bit 0-1 for signature, bit 4-5 for authentication (bit 2-3 is
+ * for decryption, which is not ECDSA, so, always 0).
+ */
+static const uint8_t *ecdsa_nonce_p;
+
+int
+gpg_do_get_ecdsa_nonce (enum kind_of_key kk)
+{
+  if (ecdsa_nonce_p == NULL)
+    return ECDSA_NONCE_RANDOM;
+
+  return (ecdsa_nonce_p[1] >> (kk * 2)) & 3;
+}
+
+static int
+rw_ecdsa_nonce (uint16_t tag, int with_tag,
+		const uint8_t *data, int len, int is_write)
+{
+  uint8_t v = ecdsa_nonce_p ? ecdsa_nonce_p[1] : 0;
+
+  if (tag != GPG_DO_ECDSA_NONCE)
+    return 0;		/* Failure */
+
+  if (is_write)
+    {
+      if (len != 1 || (data[0] & 0xcc) != 0
+	  || (data[0] & 0x03) > ECDSA_NONCE_HEDGED
+	  || ((data[0] >> 4) & 0x03) > ECDSA_NONCE_HEDGED)
+	return 0;
+
+      if (data[0] == v)
+	return 1;
+
+      flash_enum_clear (&ecdsa_nonce_p);
+      if (ecdsa_nonce_p != NULL)
+	return 0;
+
+      if (data[0] != 0)
+	{
+	  ecdsa_nonce_p = flash_enum_write (NR_DO_ECDSA_NONCE, data[0]);
+	  if (ecdsa_nonce_p == NULL)
+	    return 0;
+	}
+
+      return 1;
+    }
+  else
+    {
+      if (with_tag)
+	{
+	  copy_tag (tag);
+	  *res_p++ = 1;
+	}
+
+      *res_p++ = v;
+      return 1;
+    }
+}
+
+
 #define SIZE_OF_KDF_DO_MIN              90
 #define SIZE_OF_KDF_DO_MAX             110
 #define OPENPGP_KDF_ITERSALTED_S2K 3
@@ -1084,8 +1125,14 @@ proc_resetting_code (const uint8_t *data, int len)
   return 1;
 }
 
+/*
+ * Key data is encrypted as a stream of: private key data (of LEN) in
+ * DATA, CRT parameters (of CRT_LEN) in CRT, and the checksum, which
+ * follows the private key data in DATA.
+ */
 static void
-encrypt (const uint8_t *key, const uint8_t *iv, uint8_t *data, int len)
+encrypt (const uint8_t *key, const uint8_t *iv, uint8_t *data, int len,
+	 uint8_t *crt, int crt_len)
 {
   aes_context aes;
   uint8_t iv0[INITIAL_VECTOR_SIZE];
@@ -1098,13 +1145,17 @@ encrypt (const uint8_t *key, const uint8_t *iv, uint8_t *data, int len)
   memcpy (iv0, iv, INITIAL_VECTOR_SIZE);
   iv_offset = 0;
   aes_crypt_cfb128 (&aes, AES_ENCRYPT, len, &iv_offset, iv0, data, data);
+  aes_crypt_cfb128 (&aes, AES_ENCRYPT, crt_len, &iv_offset, iv0, crt, crt);
+  aes_crypt_cfb128 (&aes, AES_ENCRYPT, DATA_ENCRYPTION_KEY_SIZE, &iv_offset,
+		    iv0, data + len, data + len);
 }
 
 /* For three keys: Signing, Decryption, and Authentication */
 struct key_data kd[3];
 
 static void
-decrypt (const uint8_t *key, const uint8_t *iv, uint8_t *data, int len)
+decrypt (const uint8_t *key, const uint8_t *iv, uint8_t *data, int len,
+	 uint8_t *crt, int crt_len)
 {
   aes_context aes;
   uint8_t iv0[INITIAL_VECTOR_SIZE];
@@ -1114,6 +1165,9 @@ decrypt (const uint8_t *key, const uint8_t *iv, uint8_t *data, int len)
   memcpy (iv0, iv, INITIAL_VECTOR_SIZE);
   iv_offset = 0;
   aes_crypt_cfb128 (&aes, AES_DECRYPT, len, &iv_offset, iv0, data, data);
+  aes_crypt_cfb128 (&aes, AES_DECRYPT, crt_len, &iv_offset, iv0, crt, crt);
+  aes_crypt_cfb128 (&aes, AES_DECRYPT, DATA_ENCRYPTION_KEY_SIZE, &iv_offset,
+		    iv0, data + len, data + len);
 
   DEBUG_INFO ("DEC\r\n");
   DEBUG_BINARY (data, len);
@@ -1152,16 +1206,42 @@ get_do_ptr_nr_for_kk (enum kind_of_key kk)
   return NR_DO_PRVKEY_SIG;
 }
 
+/*
+ * Return 1 if the RSA private key for KK is stored with its CRT
+ * parameters.  When there is no key, return 1 if a new key will be
+ * stored so.
+ */
+static int
+prvkey_rsa_crt_stored (enum kind_of_key kk)
+{
+  const uint8_t *do_data = do_ptr[get_do_ptr_nr_for_kk (kk)];
+
+  if (do_data)
+    return (do_data[0] == PRVKEY_DO_MAX_LEN
+	    && do_data[PRVKEY_DO_MAX_LEN] == PRVKEY_FORMAT_RSA_CRT);
+
+#if defined(RSA_CRT_STORAGE_SUPPORT)
+  /* Only when it fits in a page.  */
+  if (gpg_get_algo_attr (kk) == ALGO_RSA4K)
+    return flash_get_page_size () >= 2048;
+  else
+    return flash_get_page_size () >= 1024;
+#else
+  return 0;
+#endif
+}
+
 void
 gpg_do_clear_prvkey (enum kind_of_key kk)
 {
   memset (kd[kk].data, 0, MAX_PRVKEY_LEN);
+  if (rsa_crt.kd == &kd[kk])
+    rsa_crt_clear ();
 }
 
 
 #define CHECKSUM_ADDR(kdi,prvkey_len) \
 	(&(kdi).data[prvkey_len / sizeof (uint32_t)])
-#define kdi_len(prvkey_len) (prvkey_len+DATA_ENCRYPTION_KEY_SIZE)
 struct key_data_internal {
   uint32_t data[(MAX_PRVKEY_LEN+DATA_ENCRYPTION_KEY_SIZE) / sizeof (uint32_t)];
   /*
@@ -1171,10 +1251,15 @@ struct key_data_internal {
   /* Checksum */
 };
 
+/*
+ * The checksum covers CRT parameters (of CRT_LEN) too, when an RSA key
+ * is stored with them.  PRVKEY_LEN is a multiple of 16.
+ */
 #define CKDC_CALC  0
 #define CKDC_CHECK 1
 static int
 compute_key_data_checksum (struct key_data_internal *kdi, int prvkey_len,
+			   const uint32_t *crt, int crt_len,
 			   int check_or_calc)
 {
   unsigned int i;
@@ -1183,6 +1268,8 @@ compute_key_data_checksum (struct key_data_internal *kdi, int prvkey_len,
 
   for (i = 0; i < prvkey_len / sizeof (uint32_t); i++)
     d[i&3] ^= kdi->data[i];
+  for (i = 0; i < crt_len / sizeof (uint32_t); i++)
+    d[i&3] ^= crt[i];
 
   if (check_or_calc == CKDC_CALC)	/* store */
     {
@@ -1202,12 +1289,14 @@ int
 gpg_do_load_prvkey (enum kind_of_key kk, int who, const uint8_t *keystring)
 {
   uint8_t nr = get_do_ptr_nr_for_kk (kk);
+  int attr = gpg_get_algo_attr (kk);
   int prvkey_len = gpg_get_algo_attr_key_size (kk, GPG_KEY_PRIVATE);
   const uint8_t *do_data = do_ptr[nr];
   const uint8_t *key_addr;
   uint8_t dek[DATA_ENCRYPTION_KEY_SIZE];
   const uint8_t *iv;
   struct key_data_internal kdi;
+  int crt_len = 0;
 
   DEBUG_INFO ("Loading private key: ");
   DEBUG_BYTE (kk);
@@ -1215,6 +1304,15 @@ gpg_do_load_prvkey (enum kind_of_key kk, int who, const uint8_t *keystring)
   if (do_data == NULL)
     return 0;
 
+  if ((attr == ALGO_RSA2K || attr == ALGO_RSA4K)
+      && prvkey_rsa_crt_stored (kk))
+    {
+      crt_len = prvkey_len / 2 * 3;
+      /* Decrypt CRT parameters, placed after the public key, in place.  */
+      rsa_crt.kd = NULL;
+      memcpy (rsa_crt.data, kd[kk].pubkey + prvkey_len, crt_len);
+    }
+
   key_addr = kd[kk].pubkey - prvkey_len;
   memcpy (kdi.data, key_addr, prvkey_len);
   iv = &do_data[1];
@@ -1224,16 +1322,34 @@ gpg_do_load_prvkey (enum kind_of_key kk, int who, const uint8_t *keystring)
   memcpy (dek, iv + DATA_ENCRYPTION_KEY_SIZE*(who+1), DATA_ENCRYPTION_KEY_SIZE);
   decrypt_dek (keystring, dek);
 
-  decrypt (dek, iv, (uint8_t *)&kdi, kdi_len (prvkey_len));
+  decrypt (dek, iv, (uint8_t *)&kdi, prvkey_len,
+	   (uint8_t *)rsa_crt.data, crt_len);
   memset (dek, 0, DATA_ENCRYPTION_KEY_SIZE);
-  if (!compute_key_data_checksum (&kdi, prvkey_len, CKDC_CHECK))
+  if (!compute_key_data_checksum (&kdi, prvkey_len, rsa_crt.data, crt_len,
+				  CKDC_CHECK))
     {
       DEBUG_INFO ("gpg_do_load_prvkey failed.\r\n");
+      memset (&kdi, 0, sizeof (kdi));
+      if (crt_len)
+	rsa_crt_clear ();
       return -1;
     }
 
   memcpy (kd[kk].data, kdi.data, prvkey_len);
   DEBUG_BINARY (kd[kk].data, prvkey_len);
+
+  /*
+   * For RSA, use the stored CRT parameters, or compute them once here,
+   * so that each private key operation only does the exponentiation.
+   * They are kept for a key at a time.  When a private key operation
+   * is done by another key, they are computed by the operation itself.
+   */
+  if (crt_len)
+    rsa_crt.kd = &kd[kk];
+  else if (attr == ALGO_RSA2K || attr == ALGO_RSA4K)
+    rsa_crt_precompute (&kd[kk], prvkey_len);
+
+  memset (&kdi, 0, sizeof (kdi));
   return 1;
 }
 
@@ -1313,6 +1429,8 @@ gpg_do_terminate (void)
   pw_err_counter_p[PW_ERR_RC] = NULL;
   pw_err_counter_p[PW_ERR_PW3] = NULL;
   algo_attr_sig_p = algo_attr_dec_p = algo_attr_aut_p = NULL;
+  ecdsa_nonce_p = NULL;
+  gpg_do_bump_generation ();
 }
 
 static int
@@ -1324,12 +1442,13 @@ gpg_do_write_prvkey (enum kind_of_key kk, const uint8_t *key_data,
   int attr = gpg_get_algo_attr (kk);;
   const uint8_t *p;
   int r;
-  struct prvkey_data prv;
-  struct prvkey_data *pd = &prv;
+  uint8_t prv[PRVKEY_DO_MAX_LEN];
+  struct prvkey_data *pd = (struct prvkey_data *)prv;
   uint8_t *key_addr;
   const uint8_t *dek, *iv;
   struct key_data_internal kdi;
   int pubkey_len;
+  int crt_len = 0;
   uint8_t ks[KEYSTRING_MD_SIZE];
   enum kind_of_key kk0;
   int pw_len;
@@ -1338,6 +1457,8 @@ gpg_do_write_prvkey (enum kind_of_key kk, const uint8_t *key_data,
   DEBUG_INFO ("Key import\r\n");
   DEBUG_SHORT (prvkey_len);
 
+  gpg_do_bump_generation ();
+
   /* Delete it first, if any.  */
   gpg_do_delete_prvkey (kk, CLEAN_SINGLE);
 
@@ -1361,17 +1482,37 @@ gpg_do_write_prvkey (enum kind_of_key kk, const uint8_t *key_data,
     }
   else				/* RSA */
     {
-      int key_size = gpg_get_algo_attr_key_size (kk, GPG_KEY_STORAGE);
-
       pubkey_len = prvkey_len;
-      if (prvkey_len + pubkey_len != key_size)
+      if (prvkey_len != gpg_get_algo_attr_key_size (kk, GPG_KEY_PRIVATE))
 	return -1;
+
+      if (prvkey_rsa_crt_stored (kk))
+	crt_len = prvkey_len / 2 * 3;
+    }
+
+  memcpy (kdi.data, key_data, prvkey_len);
+  memset ((uint8_t *)kdi.data + prvkey_len, 0, MAX_PRVKEY_LEN - prvkey_len);
+
+  /*
+   * CRT parameters are computed and encrypted in RSA_CRT.  Whichever
+   * key they were of, they are cleared when done.
+   */
+  rsa_crt_clear ();
+  if (crt_len
+      && rsa_crt_compute (key_data, prvkey_len, (uint8_t *)rsa_crt.data) < 0)
+    {
+      memset (&kdi, 0, sizeof (kdi));
+      return -1;
     }
 
   DEBUG_INFO ("Getting keystore address...\r\n");
   key_addr = flash_key_alloc (kk);
   if (key_addr == NULL)
-    return -1;
+    {
+      memset (&kdi, 0, sizeof (kdi));
+      rsa_crt_clear ();
+      return -1;
+    }
 
   kd[kk].pubkey = key_addr + prvkey_len;
 
@@ -1380,10 +1521,8 @@ gpg_do_write_prvkey (enum kind_of_key kk, const uint8_t *key_data,
   DEBUG_INFO ("key_addr: ");
   DEBUG_WORD ((uint32_t)key_addr);
 
-  memcpy (kdi.data, key_data, prvkey_len);
-  memset ((uint8_t *)kdi.data + prvkey_len, 0, MAX_PRVKEY_LEN - prvkey_len);
-
-  compute_key_data_checksum (&kdi, prvkey_len, CKDC_CALC);
+  compute_key_data_checksum (&kdi, prvkey_len, rsa_crt.data, crt_len,
+			     CKDC_CALC);
 
   dek = random_bytes_get (); /* 32-byte random bytes */
   iv = dek + DATA_ENCRYPTION_KEY_SIZE;
@@ -1405,14 +1544,19 @@ gpg_do_write_prvkey (enum kind_of_key kk, const uint8_t *key_data,
 	gpg_do_chks_prvkey (kk0, BY_RESETCODE, NULL, 0, NULL);
       }
 
-  encrypt (dek, iv, (uint8_t *)&kdi, kdi_len (prvkey_len));
+  encrypt (dek, iv, (uint8_t *)&kdi, prvkey_len,
+	   (uint8_t *)rsa_crt.data, crt_len);
 
   r = flash_key_write (key_addr, (const uint8_t *)kdi.data, prvkey_len,
 		       pubkey, pubkey_len);
+  if (r == 0 && crt_len)
+    r = flash_key_write (key_addr + prvkey_len + pubkey_len,
+			 (const uint8_t *)rsa_crt.data, crt_len, NULL, 0);
+  rsa_crt_clear ();
   if (r < 0)
     {
       random_bytes_free (dek);
-      memset (pd, 0, sizeof (struct prvkey_data));
+      memset (pd, 0, sizeof (prv));
       return r;
     }
 
@@ -1429,11 +1573,17 @@ gpg_do_write_prvkey (enum kind_of_key kk, const uint8_t *key_data,
   else
     memset (pd->dek_encrypted_3, 0, DATA_ENCRYPTION_KEY_SIZE);
 
-  p = flash_do_write (nr, (const uint8_t *)pd, sizeof (struct prvkey_data));
+  if (crt_len)
+    {
+      prv[sizeof (struct prvkey_data)] = PRVKEY_FORMAT_RSA_CRT;
+      p = flash_do_write (nr, prv, PRVKEY_DO_MAX_LEN);
+    }
+  else
+    p = flash_do_write (nr, prv, sizeof (struct prvkey_data));
   do_ptr[nr] = p;
 
   random_bytes_free (dek);
-  memset (pd, 0, sizeof (struct prvkey_data));
+  memset (pd, 0, sizeof (prv));
   if (p == NULL)
     return -1;
 
@@ -1465,8 +1615,9 @@ gpg_do_chks_prvkey (enum kind_of_key kk,
   uint8_t nr = get_do_ptr_nr_for_kk (kk);
   const uint8_t *do_data = do_ptr[nr];
   uint8_t dek[DATA_ENCRYPTION_KEY_SIZE];
-  struct prvkey_data prv;
-  struct prvkey_data *pd = &prv;
+  uint8_t prv[PRVKEY_DO_MAX_LEN];
+  struct prvkey_data *pd = (struct prvkey_data *)prv;
+  int do_len;
   uint8_t *dek_p;
   int update_needed = 0;
   int r = 1;			/* Success */
@@ -1474,7 +1625,11 @@ gpg_do_chks_prvkey (enum kind_of_key kk,
   if (do_data == NULL)
     return 0;			/* No private key */
 
-  memcpy (pd, &do_data[1], sizeof (struct prvkey_data));
+  /* Keep the format byte after struct prvkey_data, if any.  */
+  do_len = do_data[0];
+  if (do_len > (int)PRVKEY_DO_MAX_LEN)
+    do_len = PRVKEY_DO_MAX_LEN;
+  memcpy (prv, &do_data[1], do_len);
 
   dek_p = ((uint8_t *)pd) + INITIAL_VECTOR_SIZE
     + DATA_ENCRYPTION_KEY_SIZE * who_old;
@@ -1508,13 +1663,13 @@ gpg_do_chks_prvkey (enum kind_of_key kk,
 
       flash_do_release (do_data);
       do_ptr[nr] = NULL;
-      p = flash_do_write (nr, (const uint8_t *)pd, sizeof (struct prvkey_data));
+      p = flash_do_write (nr, prv, do_len);
       do_ptr[nr] = p;
       if (p == NULL)
 	r = -1;
     }
 
-  memset (pd, 0, sizeof (struct prvkey_data));
+  memset (pd, 0, sizeof (prv));
 
   return r;
 }
@@ -1674,111 +1829,218 @@ proc_key_import (const uint8_t *data, int len)
     return 1;
 }
 
-static const uint16_t cmp_ch_data[] = {
+/*
+ * Index of GPG_DO_TABLE, in order of TAG, for binary search.
+ */
+enum do_index {
+  DO_IDX_AID,
+  DO_IDX_NAME,
+  DO_IDX_LOGIN_DATA,
+  DO_IDX_CH_DATA,
+  DO_IDX_APP_DATA,
+  DO_IDX_DISCRETIONARY,
+  DO_IDX_SS_TEMP,
+  DO_IDX_DS_COUNT,
+  DO_IDX_EXTCAP,
+  DO_IDX_ALG_SIG,
+  DO_IDX_ALG_DEC,
+  DO_IDX_ALG_AUT,
+  DO_IDX_PW_STATUS,
+  DO_IDX_FP_ALL,
+  DO_IDX_CAFP_ALL,
+  DO_IDX_FP_SIG,
+  DO_IDX_FP_DEC,
+  DO_IDX_FP_AUT,
+  DO_IDX_CAFP_1,
+  DO_IDX_CAFP_2,
+  DO_IDX_CAFP_3,
+  DO_IDX_KGTIME_ALL,
+  DO_IDX_KGTIME_SIG,
+  DO_IDX_KGTIME_DEC,
+  DO_IDX_KGTIME_AUT,
+  DO_IDX_RESETTING_CODE,
+#ifdef ACKBTN_SUPPORT
+  DO_IDX_UIF_SIG,
+  DO_IDX_UIF_DEC,
+  DO_IDX_UIF_AUT,
+#endif
+  DO_IDX_ECDSA_NONCE,
+  DO_IDX_KDF,
+  DO_IDX_KEY_IMPORT,
+  DO_IDX_LANGUAGE,
+  DO_IDX_SEX,
+  DO_IDX_URL,
+  DO_IDX_HIST_BYTES,
+#ifdef ACKBTN_SUPPORT
+  DO_IDX_FEATURE_MNGMNT,
+#endif
+  NUM_DO_ENTRIES
+};
+
+/*
+ * Components of compound data, by index of GPG_DO_TABLE (resolved at
+ * compile time).  The first byte is the number of components.
+ */
+static const uint8_t cmp_ch_data[] = {
   3,
-  GPG_DO_NAME,
-  GPG_DO_LANGUAGE,
-  GPG_DO_SEX,
+  DO_IDX_NAME,
+  DO_IDX_LANGUAGE,
+  DO_IDX_SEX,
 };
 
-static const uint16_t cmp_app_data[] = {
+static const uint8_t cmp_app_data[] = {
 #ifdef ACKBTN_SUPPORT
   4,
 #else
   3,
 #endif
-  GPG_DO_AID,
-  GPG_DO_HIST_BYTES,
-  GPG_DO_DISCRETIONARY,
+  DO_IDX_AID,
+  DO_IDX_HIST_BYTES,
+  DO_IDX_DISCRETIONARY,
 #ifdef ACKBTN_SUPPORT
-  GPG_DO_FEATURE_MNGMNT,
+  DO_IDX_FEATURE_MNGMNT,
 #endif
 };
 
-static const uint16_t cmp_discretionary[] = {
+static const uint8_t cmp_discretionary[] = {
 #ifdef ACKBTN_SUPPORT
   11,
 #else
   8,
 #endif
-  GPG_DO_EXTCAP,
-  GPG_DO_ALG_SIG, GPG_DO_ALG_DEC, GPG_DO_ALG_AUT,
-  GPG_DO_PW_STATUS,
-  GPG_DO_FP_ALL, GPG_DO_CAFP_ALL, GPG_DO_KGTIME_ALL,
+  DO_IDX_EXTCAP,
+  DO_IDX_ALG_SIG, DO_IDX_ALG_DEC, DO_IDX_ALG_AUT,
+  DO_IDX_PW_STATUS,
+  DO_IDX_FP_ALL, DO_IDX_CAFP_ALL, DO_IDX_KGTIME_ALL,
 #ifdef ACKBTN_SUPPORT
-  GPG_DO_UIF_SIG, GPG_DO_UIF_DEC, GPG_DO_UIF_AUT
+  DO_IDX_UIF_SIG, DO_IDX_UIF_DEC, DO_IDX_UIF_AUT
 #endif
 };
 
-static const uint16_t cmp_ss_temp[] = { 1, GPG_DO_DS_COUNT };
+static const uint8_t cmp_ss_temp[] = { 1, DO_IDX_DS_COUNT };
 
 static const struct do_table_entry
-gpg_do_table[] = {
-  /* Variables: Fixed size */
-  { GPG_DO_SEX, DO_VAR, AC_ALWAYS, AC_ADMIN_AUTHORIZED, &do_ptr[0] },
-  { GPG_DO_FP_SIG, DO_VAR, AC_ALWAYS, AC_ADMIN_AUTHORIZED, &do_ptr[1] },
-  { GPG_DO_FP_DEC, DO_VAR, AC_ALWAYS, AC_ADMIN_AUTHORIZED, &do_ptr[2] },
-  { GPG_DO_FP_AUT, DO_VAR, AC_ALWAYS, AC_ADMIN_AUTHORIZED, &do_ptr[3] },
-  { GPG_DO_CAFP_1, DO_VAR, AC_ALWAYS, AC_ADMIN_AUTHORIZED, &do_ptr[4] },
-  { GPG_DO_CAFP_2, DO_VAR, AC_ALWAYS, AC_ADMIN_AUTHORIZED, &do_ptr[5] },
-  { GPG_DO_CAFP_3, DO_VAR, AC_ALWAYS, AC_ADMIN_AUTHORIZED, &do_ptr[6] },
-  { GPG_DO_KGTIME_SIG, DO_VAR, AC_ALWAYS, AC_ADMIN_AUTHORIZED, &do_ptr[7] },
-  { GPG_DO_KGTIME_DEC, DO_VAR, AC_ALWAYS, AC_ADMIN_AUTHORIZED, &do_ptr[8] },
-  { GPG_DO_KGTIME_AUT, DO_VAR, AC_ALWAYS, AC_ADMIN_AUTHORIZED, &do_ptr[9] },
+gpg_do_table[NUM_DO_ENTRIES] = {
+  /* Pseudo DO READ: calculated, not changeable by user */
+  [DO_IDX_AID] =
+  { GPG_DO_AID, DO_PROC_READ, AC_ALWAYS, AC_NEVER, do_openpgpcard_aid },
   /* Variables: Variable size */
-  { GPG_DO_LOGIN_DATA, DO_VAR, AC_ALWAYS, AC_ADMIN_AUTHORIZED, &do_ptr[10] },
-  { GPG_DO_URL, DO_VAR, AC_ALWAYS, AC_ADMIN_AUTHORIZED, &do_ptr[11] },
-  { GPG_DO_NAME, DO_VAR, AC_ALWAYS, AC_ADMIN_AUTHORIZED, &do_ptr[12] },
-  { GPG_DO_LANGUAGE, DO_VAR, AC_ALWAYS, AC_ADMIN_AUTHORIZED, &do_ptr[13] },
-  /* Pseudo DO READ: calculated */
-  { GPG_DO_FP_ALL, DO_PROC_READ, AC_ALWAYS, AC_NEVER, do_fp_all },
-  { GPG_DO_CAFP_ALL, DO_PROC_READ, AC_ALWAYS, AC_NEVER, do_cafp_all },
-  { GPG_DO_KGTIME_ALL, DO_PROC_READ, AC_ALWAYS, AC_NEVER, do_kgtime_all },
+  [DO_IDX_NAME] =
+  { GPG_DO_NAME, DO_VAR, AC_ALWAYS, AC_ADMIN_AUTHORIZED, &do_ptr[NR_DO_NAME] },
+  [DO_IDX_LOGIN_DATA] =
+  { GPG_DO_LOGIN_DATA, DO_VAR, AC_ALWAYS, AC_ADMIN_AUTHORIZED,
+    &do_ptr[NR_DO_LOGIN_DATA] },
+  /* Compound data: Read access only */
+  [DO_IDX_CH_DATA] =
+  { GPG_DO_CH_DATA, DO_CMP_READ, AC_ALWAYS, AC_NEVER, cmp_ch_data },
+  [DO_IDX_APP_DATA] =
+  { GPG_DO_APP_DATA, DO_CMP_READ, AC_ALWAYS, AC_NEVER, cmp_app_data },
+  [DO_IDX_DISCRETIONARY] =
+  { GPG_DO_DISCRETIONARY, DO_CMP_READ, AC_ALWAYS, AC_NEVER, cmp_discretionary },
+  [DO_IDX_SS_TEMP] =
+  { GPG_DO_SS_TEMP, DO_CMP_READ, AC_ALWAYS, AC_NEVER, cmp_ss_temp },
   /* Pseudo DO READ: calculated, not changeable by user */
+  [DO_IDX_DS_COUNT] =
   { GPG_DO_DS_COUNT, DO_PROC_READ, AC_ALWAYS, AC_NEVER, do_ds_count },
-  { GPG_DO_AID, DO_PROC_READ, AC_ALWAYS, AC_NEVER, do_openpgpcard_aid },
+  /* Fixed data */
+  [DO_IDX_EXTCAP] =
+  { GPG_DO_EXTCAP, DO_FIXED, AC_ALWAYS, AC_NEVER, extended_capabilities },
   /* Pseudo DO READ/WRITE: calculated */
-  { GPG_DO_PW_STATUS, DO_PROC_READWRITE, AC_ALWAYS, AC_ADMIN_AUTHORIZED,
-    rw_pw_status },
+  [DO_IDX_ALG_SIG] =
   { GPG_DO_ALG_SIG, DO_PROC_READWRITE, AC_ALWAYS, AC_ADMIN_AUTHORIZED,
     rw_algorithm_attr },
+  [DO_IDX_ALG_DEC] =
   { GPG_DO_ALG_DEC, DO_PROC_READWRITE, AC_ALWAYS, AC_ADMIN_AUTHORIZED,
     rw_algorithm_attr },
+  [DO_IDX_ALG_AUT] =
   { GPG_DO_ALG_AUT, DO_PROC_READWRITE, AC_ALWAYS, AC_ADMIN_AUTHORIZED,
     rw_algorithm_attr },
+  [DO_IDX_PW_STATUS] =
+  { GPG_DO_PW_STATUS, DO_PROC_READWRITE, AC_ALWAYS, AC_ADMIN_AUTHORIZED,
+    rw_pw_status },
+  /* Pseudo DO READ: calculated */
+  [DO_IDX_FP_ALL] =
+  { GPG_DO_FP_ALL, DO_PROC_READ, AC_ALWAYS, AC_NEVER, do_fp_all },
+  [DO_IDX_CAFP_ALL] =
+  { GPG_DO_CAFP_ALL, DO_PROC_READ, AC_ALWAYS, AC_NEVER, do_cafp_all },
+  /* Variables: Fixed size */
+  [DO_IDX_FP_SIG] =
+  { GPG_DO_FP_SIG, DO_VAR, AC_ALWAYS, AC_ADMIN_AUTHORIZED,
+    &do_ptr[NR_DO_FP_SIG] },
+  [DO_IDX_FP_DEC] =
+  { GPG_DO_FP_DEC, DO_VAR, AC_ALWAYS, AC_ADMIN_AUTHORIZED,
+    &do_ptr[NR_DO_FP_DEC] },
+  [DO_IDX_FP_AUT] =
+  { GPG_DO_FP_AUT, DO_VAR, AC_ALWAYS, AC_ADMIN_AUTHORIZED,
+    &do_ptr[NR_DO_FP_AUT] },
+  [DO_IDX_CAFP_1] =
+  { GPG_DO_CAFP_1, DO_VAR, AC_ALWAYS, AC_ADMIN_AUTHORIZED,
+    &do_ptr[NR_DO_CAFP_1] },
+  [DO_IDX_CAFP_2] =
+  { GPG_DO_CAFP_2, DO_VAR, AC_ALWAYS, AC_ADMIN_AUTHORIZED,
+    &do_ptr[NR_DO_CAFP_2] },
+  [DO_IDX_CAFP_3] =
+  { GPG_DO_CAFP_3, DO_VAR, AC_ALWAYS, AC_ADMIN_AUTHORIZED,
+    &do_ptr[NR_DO_CAFP_3] },
+  /* Pseudo DO READ: calculated */
+  [DO_IDX_KGTIME_ALL] =
+  { GPG_DO_KGTIME_ALL, DO_PROC_READ, AC_ALWAYS, AC_NEVER, do_kgtime_all },
+  /* Variables: Fixed size */
+  [DO_IDX_KGTIME_SIG] =
+  { GPG_DO_KGTIME_SIG, DO_VAR, AC_ALWAYS, AC_ADMIN_AUTHORIZED,
+    &do_ptr[NR_DO_KGTIME_SIG] },
+  [DO_IDX_KGTIME_DEC] =
+  { GPG_DO_KGTIME_DEC, DO_VAR, AC_ALWAYS, AC_ADMIN_AUTHORIZED,
+    &do_ptr[NR_DO_KGTIME_DEC] },
+  [DO_IDX_KGTIME_AUT] =
+  { GPG_DO_KGTIME_AUT, DO_VAR, AC_ALWAYS, AC_ADMIN_AUTHORIZED,
+    &do_ptr[NR_DO_KGTIME_AUT] },
+  /* Simple data: write access only */
+  [DO_IDX_RESETTING_CODE] =
+  { GPG_DO_RESETTING_CODE, DO_PROC_WRITE, AC_NEVER, AC_ADMIN_AUTHORIZED,
+    proc_resetting_code },
 #ifdef ACKBTN_SUPPORT
+  /* Pseudo DO READ/WRITE: calculated */
+  [DO_IDX_UIF_SIG] =
   { GPG_DO_UIF_SIG, DO_PROC_READWRITE, AC_ALWAYS, AC_ADMIN_AUTHORIZED, rw_uif },
+  [DO_IDX_UIF_DEC] =
   { GPG_DO_UIF_DEC, DO_PROC_READWRITE, AC_ALWAYS, AC_ADMIN_AUTHORIZED, rw_uif },
+  [DO_IDX_UIF_AUT] =
   { GPG_DO_UIF_AUT, DO_PROC_READWRITE, AC_ALWAYS, AC_ADMIN_AUTHORIZED, rw_uif },
 #endif
-  { GPG_DO_KDF, DO_PROC_READWRITE, AC_ALWAYS, AC_ADMIN_AUTHORIZED,
-    rw_kdf },
+  /* Pseudo DO READ/WRITE: calculated */
+  [DO_IDX_ECDSA_NONCE] =
+  { GPG_DO_ECDSA_NONCE, DO_PROC_READWRITE, AC_ALWAYS, AC_ADMIN_AUTHORIZED,
+    rw_ecdsa_nonce },
+  [DO_IDX_KDF] =
+  { GPG_DO_KDF, DO_PROC_READWRITE, AC_ALWAYS, AC_ADMIN_AUTHORIZED, rw_kdf },
+  /* Compound data: Write access only */
+  [DO_IDX_KEY_IMPORT] =
+  { GPG_DO_KEY_IMPORT, DO_PROC_WRITE, AC_NEVER, AC_ADMIN_AUTHORIZED,
+    proc_key_import },
+  /* Variables: Variable size */
+  [DO_IDX_LANGUAGE] =
+  { GPG_DO_LANGUAGE, DO_VAR, AC_ALWAYS, AC_ADMIN_AUTHORIZED,
+    &do_ptr[NR_DO_LANGUAGE] },
+  /* Variables: Fixed size */
+  [DO_IDX_SEX] =
+  { GPG_DO_SEX, DO_VAR, AC_ALWAYS, AC_ADMIN_AUTHORIZED, &do_ptr[NR_DO_SEX] },
+  /* Variables: Variable size */
+  [DO_IDX_URL] =
+  { GPG_DO_URL, DO_VAR, AC_ALWAYS, AC_ADMIN_AUTHORIZED, &do_ptr[NR_DO_URL] },
   /* Fixed data */
+  [DO_IDX_HIST_BYTES] =
   { GPG_DO_HIST_BYTES, DO_FIXED, AC_ALWAYS, AC_NEVER, historical_bytes },
-  { GPG_DO_EXTCAP, DO_FIXED, AC_ALWAYS, AC_NEVER, extended_capabilities },
 #ifdef ACKBTN_SUPPORT
+  [DO_IDX_FEATURE_MNGMNT] =
   { GPG_DO_FEATURE_MNGMNT, DO_FIXED, AC_ALWAYS, AC_NEVER, feature_mngmnt },
 #endif
-  /* Compound data: Read access only */
-  { GPG_DO_CH_DATA, DO_CMP_READ, AC_ALWAYS, AC_NEVER, cmp_ch_data },
-  { GPG_DO_APP_DATA, DO_CMP_READ, AC_ALWAYS, AC_NEVER, cmp_app_data },
-  { GPG_DO_DISCRETIONARY, DO_CMP_READ, AC_ALWAYS, AC_NEVER, cmp_discretionary },
-  { GPG_DO_SS_TEMP, DO_CMP_READ, AC_ALWAYS, AC_NEVER, cmp_ss_temp },
-  /* Simple data: write access only */
-  { GPG_DO_RESETTING_CODE, DO_PROC_WRITE, AC_NEVER, AC_ADMIN_AUTHORIZED,
-    proc_resetting_code },
-  /* Compound data: Write access only */
-  { GPG_DO_KEY_IMPORT, DO_PROC_WRITE, AC_NEVER, AC_ADMIN_AUTHORIZED,
-    proc_key_import },
-#if 0
-  /* Card holder certificate is handled in special way, as its size is big */
-  { GPG_DO_CH_CERTIFICATE, DO_VAR, AC_ALWAYS, AC_ADMIN_AUTHORIZED, NULL },
-#endif
+  /*
+   * Card holder certificate (0x7f21) is handled in special way, as
+   * its size is big.  It's not in this table.
+   */
 };
 
-#define NUM_DO_ENTRIES (int)(sizeof (gpg_do_table) \
-			     / sizeof (struct do_table_entry))
-
 /*
  * Reading data from Flash ROM, initialize DO_PTR, PW_ERR_COUNTERS, etc.
  */
@@ -1789,6 +2051,7 @@ gpg_data_scan (const uint8_t *do_start, const uint8_t *do_end)
   int i;
   const uint8_t *dsc_h14_p, *dsc_l10_p;
   int dsc_h14, dsc_l10;
+  int dsc_l10_is_newer = 0;
 
   dsc_h14_p = dsc_l10_p = NULL;
   pw1_lifetime_p = NULL;
@@ -1796,7 +2059,9 @@ gpg_data_scan (const uint8_t *do_start, const uint8_t *do_end)
   pw_err_counter_p[PW_ERR_RC] = NULL;
   pw_err_counter_p[PW_ERR_PW3] = NULL;
   algo_attr_sig_p = algo_attr_dec_p = algo_attr_aut_p = NULL;
+  ecdsa_nonce_p = NULL;
   digital_signature_counter = 0;
+  gpg_do_bump_generation ();
   uif_flags = 0;
 
   /* Clear all data objects.  */
@@ -1809,10 +2074,25 @@ gpg_data_scan (const uint8_t *do_start, const uint8_t *do_end)
 
   /* Traverse DO, counters, etc. in DATA pool */
   p = do_start;
-  while (p < do_end && *p != NR_EMPTY)
+  while (1)
     {
-      uint8_t nr = *p++;
-      uint8_t second_byte = *p;
+      uint8_t nr;
+      uint8_t second_byte;
+
+      if (p >= do_end || *p == NR_EMPTY)
+	{
+	  /* Go to the next page of the log, if any.  */
+	  const uint8_t *next = flash_do_storage_next (&do_end);
+
+	  if (next == NULL)
+	    break;
+
+	  p = next;
+	  continue;
+	}
+
+      nr = *p++;
+      second_byte = *p;
 
       if (nr == 0x00 && second_byte == 0x00)
 	p++;			/* Skip released word */
@@ -1821,8 +2101,9 @@ gpg_data_scan (const uint8_t *do_start, const uint8_t *do_end)
 	  if (nr < 0x80)
 	    {
 	      /* It's Data Object */
+	      /* Zero-length record is a tombstone of released DO.  */
 	      if (nr < NR_DO__LAST__)
-		do_ptr[nr] = p;
+		do_ptr[nr] = second_byte ? p : NULL;
 
 	      p += second_byte + 1; /* second_byte has length */
 
@@ -1833,12 +2114,14 @@ gpg_data_scan (const uint8_t *do_start, const uint8_t *do_end)
 	    /* Encoded data of Digital Signature Counter: upper 14-bit */
 	    {
 	      dsc_h14_p = p - 1;
+	      dsc_l10_is_newer = 0;
 	      p++;
 	    }
 	  else if (nr >= 0xc0 && nr <= 0xc3)
 	    /* Encoded data of Digital Signature Counter: lower 10-bit */
 	    {
 	      dsc_l10_p = p - 1;
+	      dsc_l10_is_newer = 1;
 	      p++;
 	    }
 	  else
@@ -1867,6 +2150,10 @@ gpg_data_scan (const uint8_t *do_start, const uint8_t *do_end)
 		uif_flags |= (second_byte & 3) << ((nr - NR_DO_UIF_SIG) * 2);
 		p++;
 		break;
+	      case NR_DO_ECDSA_NONCE:
+		ecdsa_nonce_p = p - 1;
+		p++;
+		break;
 	      case NR_COUNTER_123:
 		p++;
 		if (second_byte <= PW_ERR_PW3)
@@ -1908,7 +2195,7 @@ gpg_data_scan (const uint8_t *do_start, const uint8_t *do_end)
       dsc_h14 = ((*dsc_h14_p - 0x80) << 8) | *(dsc_h14_p + 1);
       if (dsc_l10_p == NULL)
 	DEBUG_INFO ("something wrong in DSC\r\n"); /* weird??? */
-      else if (dsc_l10_p < dsc_h14_p)
+      else if (!dsc_l10_is_newer)
 	/* Possibly, power off during writing dsc_l10 */
 	dsc_l10 = 0;
     }
@@ -1973,6 +2260,13 @@ gpg_data_copy (const uint8_t *p_start)
 	p += 2;
       }
 
+  if (ecdsa_nonce_p != NULL)
+    {
+      flash_enum_write_internal (p, NR_DO_ECDSA_NONCE, ecdsa_nonce_p[1]);
+      ecdsa_nonce_p = p;
+      p += 2;
+    }
+
   data_objects_number_of_bytes = 0;
   for (i = 0; i < NR_DO__LAST__; i++)
     if (do_ptr[i] != NULL)
@@ -1989,14 +2283,62 @@ gpg_data_copy (const uint8_t *p_start)
   flash_set_data_pool_last (p);
 }
 
+/*
+ * Return the number of bytes which gpg_data_copy writes, that is, the
+ * size of live data in the data pool.  Keep in sync with gpg_data_copy.
+ */
+int
+gpg_data_live_size (void)
+{
+  int size;
+  int i;
+
+  size = (digital_signature_counter >> 10) == 0 ? 2 : 4;
+
+  if (pw1_lifetime_p != NULL)
+    size += 2;
+  if (algo_attr_sig_p != NULL)
+    size += 2;
+  if (algo_attr_dec_p != NULL)
+    size += 2;
+  if (algo_attr_aut_p != NULL)
+    size += 2;
+
+  for (i = 0; i < 3; i++)
+    if (flash_cnt123_get_value (pw_err_counter_p[i]) != 0)
+      size += 4;
+
+  for (i = 0; i < 3; i++)
+    if (((uif_flags >> (i * 2)) & 3))
+      size += 2;
+
+  if (ecdsa_nonce_p != NULL)
+    size += 2;
+
+  for (i = 0; i < NR_DO__LAST__; i++)
+    if (do_ptr[i] != NULL)
+      size += 2 + ((do_ptr[i][0] + 1) & ~1);
+
+  return size;
+}
+
 static const struct do_table_entry *
 get_do_entry (uint16_t tag)
 {
-  int i;
+  int lo = 0;
+  int hi = NUM_DO_ENTRIES - 1;
+
+  while (lo <= hi)
+    {
+      int i = (lo + hi) / 2;
 
-  for (i = 0; i < NUM_DO_ENTRIES; i++)
-    if (gpg_do_table[i].tag == tag)
-      return &gpg_do_table[i];
+      if (gpg_do_table[i].tag == tag)
+	return &gpg_do_table[i];
+      else if (gpg_do_table[i].tag < tag)
+	lo = i + 1;
+      else
+	hi = i - 1;
+    }
 
   return NULL;
 }
@@ -2057,7 +2399,7 @@ copy_do (const struct do_table_entry *do_p, int with_tag)
     case DO_CMP_READ:
       {
 	int i;
-	const uint16_t *cmp_data = (const uint16_t *)do_p->obj;
+	const uint8_t *cmp_data = (const uint8_t *)do_p->obj;
 	int num_components = cmp_data[0];
 	uint8_t *len_p = NULL;
 
@@ -2070,15 +2412,8 @@ copy_do (const struct do_table_entry *do_p, int with_tag)
 	  }
 
 	for (i = 0; i < num_components; i++)
-	  {
-	    uint16_t tag0;
-	    const struct do_table_entry *do0_p;
-
-	    tag0 = cmp_data[i+1];
-	    do0_p = get_do_entry (tag0);
-	    if (copy_do (do0_p, 1) < 0)
-	      return -1;
-	  }
+	  if (copy_do (&gpg_do_table[cmp_data[i+1]], 1) < 0)
+	    return -1;
 
 	if (len_p)
 	  *len_p = res_p - len_p - 1;
@@ -2104,6 +2439,17 @@ copy_do (const struct do_table_entry *do_p, int with_tag)
   return 1;
 }
 
+/*
+ * Cache of Application Related Data (without its tag), which host
+ * reads on each card enumeration.  Its serialization walks more than
+ * ten DOs.  Other compound DOs are small and not cached.  All of its
+ * components are AC_ALWAYS, so it doesn't depend on authentication.
+ */
+#define APP_DATA_CACHE_SIZE 256
+static uint32_t app_data_cache_generation; /* 0 for none */
+static uint16_t app_data_cache_len;
+static uint8_t app_data_cache[APP_DATA_CACHE_SIZE];
+
 /*
  * Process GET_DATA request on Data Object specified by TAG
  *   Call write_res_adpu to fill data returned
@@ -2135,13 +2481,20 @@ gpg_do_get_data (uint16_t tag, int with_tag)
 #endif
     {
       const struct do_table_entry *do_p = get_do_entry (tag);
+      int cacheable = (do_p == &gpg_do_table[DO_IDX_APP_DATA] && !with_tag);
 
       res_p = res_APDU;
 
       DEBUG_INFO ("   ");
       DEBUG_SHORT (tag);
 
-      if (do_p)
+      if (cacheable && app_data_cache_generation == do_generation)
+	{
+	  memcpy (res_APDU, app_data_cache, app_data_cache_len);
+	  res_APDU_size = app_data_cache_len;
+	  GPG_SUCCESS ();
+	}
+      else if (do_p)
 	{
 	  if (copy_do (do_p, with_tag) < 0)
 	    /* Overwriting partially written result  */
@@ -2149,6 +2502,12 @@ gpg_do_get_data (uint16_t tag, int with_tag)
 	  else
 	    {
 	      res_APDU_size = res_p - res_APDU;
+	      if (cacheable && res_APDU_size <= APP_DATA_CACHE_SIZE)
+		{
+		  memcpy (app_data_cache, res_APDU, res_APDU_size);
+		  app_data_cache_len = res_APDU_size;
+		  app_data_cache_generation = do_generation;
+		}
 	      GPG_SUCCESS ();
 	    }
 	}
@@ -2173,6 +2532,8 @@ gpg_do_put_data (uint16_t tag, const uint8_t *data, int len)
 	  return;
 	}
 
+      gpg_do_bump_generation ();
+
       switch (do_p->do_type)
 	{
 	case DO_FIXED:
@@ -2197,19 +2558,15 @@ gpg_do_put_data (uint16_t tag, const uint8_t *data, int len)
 	      GPG_MEMORY_FAILURE ();
 	    else
 	      {
-		int nr = do_tag_to_nr (tag);
+		/* DO_VAR entry points DO_PTR[NR] */
+		int nr = do_data_p - do_ptr;
 
-		if (nr < 0)
-		  GPG_MEMORY_FAILURE ();
+		*do_data_p = NULL;
+		*do_data_p = flash_do_write (nr, data, len);
+		if (*do_data_p)
+		  GPG_SUCCESS ();
 		else
-		  {
-		    *do_data_p = NULL;
-		    *do_data_p = flash_do_write (nr, data, len);
-		    if (*do_data_p)
-		      GPG_SUCCESS ();
-		    else
-		      GPG_MEMORY_FAILURE ();
-		  }
+		  GPG_MEMORY_FAILURE ();
 	      }
 	    break;
 	  }
@@ -2335,6 +2692,7 @@ gpg_do_write_simple (uint8_t nr, const uint8_t *data, int size)
 {
   const uint8_t **do_data_p;
 
+  gpg_do_bump_generation ();
   do_data_p = (const uint8_t **)&do_ptr[nr];
   if (*do_data_p)
     flash_do_release (*do_data_p);
@@ -2360,18 +2718,31 @@ gpg_do_keygen (uint8_t *buf)
   const uint8_t *prv;
   const uint8_t *rnd;
   int r = 0;
+  uint8_t *pubkey = &buf[3+256];
+  uint8_t *pubkey_alloc = NULL;
 #define p_q (&buf[3])
 #define d (&buf[3])
 #define d1 (&buf[3+64])
-#define pubkey (&buf[3+256])
 
   DEBUG_INFO ("Keygen\r\n");
   DEBUG_BYTE (kk_byte);
 
   if (attr == ALGO_RSA2K || attr == ALGO_RSA4K)
     {
+      if (3 + prvkey_len * 2 > MAX_CMD_APDU_DATA_SIZE)
+	{
+	  /* For RSA-4096, N doesn't fit in the buffer after P and Q.  */
+	  pubkey = pubkey_alloc = gnuk_malloc (prvkey_len);
+	  if (pubkey == NULL)
+	    {
+	      GPG_MEMORY_FAILURE ();
+	      return;
+	    }
+	}
+
       if (rsa_genkey (prvkey_len, pubkey, p_q) < 0)
 	{
+	  gnuk_free (pubkey_alloc);
 	  GPG_MEMORY_FAILURE ();
 	  return;
 	}
@@ -2453,8 +2824,10 @@ gpg_do_keygen (uint8_t *buf)
       r = gpg_do_write_prvkey (kk, prv, prvkey_len, keystring_admin, pubkey);
     }
 
+  gnuk_free (pubkey_alloc);
+
   /* Clear private key data in the buffer.  */
-  memset (buf, 0, 256);
+  memset (buf, 0, 3 + (prvkey_len > 256 ? prvkey_len : 256));
 
   if (r < 0)
     {
@@ -1004,10 +1004,12 @@ cmd_pso (struct eventflag *ccid_comm)
 	  result_len = ECDSA_SIGNATURE_LENGTH;
 	  if (attr == ALGO_NISTP256R1)
 	    r = ecdsa_sign_p256r1 (apdu.cmd_apdu_data, res_APDU,
-				   kd[GPG_KEY_FOR_SIGNING].data);
+				   kd[GPG_KEY_FOR_SIGNING].data,
+				   gpg_do_get_ecdsa_nonce (GPG_KEY_FOR_SIGNING));
 	  else			/* ALGO_SECP256K1 */
 	    r = ecdsa_sign_p256k1 (apdu.cmd_apdu_data, res_APDU,
-				   kd[GPG_KEY_FOR_SIGNING].data);
+				   kd[GPG_KEY_FOR_SIGNING].data,
+				   gpg_do_get_ecdsa_nonce (GPG_KEY_FOR_SIGNING));
 	  chopstx_setcancelstate (cs);
 	}
       else if (attr == ALGO_ED25519)
@@ -1205,7 +1207,8 @@ cmd_internal_authenticate (struct eventflag *ccid_comm)
       cs = chopstx_setcancelstate (0);
       result_len = ECDSA_SIGNATURE_LENGTH;
       r = ecdsa_sign_p256r1 (apdu.cmd_apdu_data, res_APDU,
-			     kd[GPG_KEY_FOR_AUTHENTICATION].data);
+			     kd[GPG_KEY_FOR_AUTHENTICATION].data,
+			     gpg_do_get_ecdsa_nonce (GPG_KEY_FOR_AUTHENTICATION));
       chopstx_setcancelstate (cs);
     }
   else if (attr == ALGO_SECP256K1)
@@ -1220,7 +1223,8 @@ cmd_internal_authenticate (struct eventflag *ccid_comm)
       cs = chopstx_setcancelstate (0);
       result_len = ECDSA_SIGNATURE_LENGTH;
       r = ecdsa_sign_p256k1 (apdu.cmd_apdu_data, res_APDU,
-			     kd[GPG_KEY_FOR_AUTHENTICATION].data);
+			     kd[GPG_KEY_FOR_AUTHENTICATION].data,
+			     gpg_do_get_ecdsa_nonce (GPG_KEY_FOR_AUTHENTICATION));
       chopstx_setcancelstate (cs);
     }
   else if (attr == ALGO_ED25519)
@@ -1425,15 +1429,48 @@ cmd_external_authenticate (struct eventflag *ccid_comm)
 }
 #endif
 
+/*
+ * GET CHALLENGE with P1 != 0 is Gnuk specific: it streams output of
+ * NeuG directly, so that host can use the token as an entropy
+ * source.  P1 is NEUG_MODE_* + 1: 1 for conditioned, 2 for raw
+ * (CRC-32 filtered), 3 for raw sample data.  Up to
+ * MAX_RES_APDU_DATA_SIZE bytes for an APDU.
+ *
+ * P1 = 0 is allowed for any file and for terminated card, as before
+ * (the challenge for EXTERNAL AUTHENTICATE).  Streaming is only
+ * allowed when the OpenPGP application is selected.
+ */
+#define CHALLENGE_P1_DRBG   0
+#define CHALLENGE_P1_NEUG   1
+#define CHALLENGE_P1_LAST   3
+
 static void
 cmd_get_challenge (struct eventflag *ccid_comm)
 {
   int len = apdu.expected_res_size;
+  uint8_t p1 = P1 (apdu);
+  int max_len = p1 == CHALLENGE_P1_DRBG ? CHALLENGE_LEN
+    : MAX_RES_APDU_DATA_SIZE;
 
   (void)ccid_comm;
   DEBUG_INFO (" - GET CHALLENGE\r\n");
 
-  if (len > CHALLENGE_LEN)
+  if (p1 > CHALLENGE_P1_LAST)
+    {
+      GPG_BAD_P1_P2 ();
+      return;
+    }
+
+  if (p1 != CHALLENGE_P1_DRBG && file_selection != FILE_DF_OPENPGP)
+    {
+      if (file_selection == FILE_CARD_TERMINATED)
+	GPG_APPLICATION_TERMINATED ();
+      else
+	GPG_NO_RECORD ();
+      return;
+    }
+
+  if (len > max_len)
     {
       GPG_CONDITION_NOT_SATISFIED ();
       return;
@@ -1442,9 +1479,6 @@ cmd_get_challenge (struct eventflag *ccid_comm)
     /* Le is not specified.  Return full-sized challenge by GET_RESPONSE.  */
     len = CHALLENGE_LEN;
 
-  if (challenge)
-    random_bytes_free (challenge);
-
 #ifdef ACKBTN_SUPPORT
   if (gpg_do_get_uif (GPG_KEY_FOR_SIGNING)
       || gpg_do_get_uif (GPG_KEY_FOR_DECRYPTION)
@@ -1452,8 +1486,17 @@ cmd_get_challenge (struct eventflag *ccid_comm)
     eventflag_signal (ccid_comm, EV_EXEC_ACK_REQUIRED);
 #endif
 
-  challenge = random_bytes_get ();
-  memcpy (res_APDU, challenge, len);
+  if (p1 == CHALLENGE_P1_DRBG)
+    {
+      if (challenge)
+	random_bytes_free (challenge);
+
+      challenge = random_bytes_get_for (RANDOM_FOR_CHALLENGE);
+      memcpy (res_APDU, challenge, len);
+    }
+  else
+    random_stream (res_APDU, len, p1 - CHALLENGE_P1_NEUG);
+
   res_APDU_size = len;
   GPG_SUCCESS ();
   DEBUG_INFO ("GET CHALLENGE done.\r\n");
@@ -1526,67 +1569,72 @@ cmd_terminate_df (struct eventflag *ccid_comm)
 
 struct command
 {
-  uint8_t command;
   void (*cmd_handler) (struct eventflag *ccid_comm);
+  uint8_t flags;
 };
 
-const struct command cmds[] = {
-  { INS_VERIFY, cmd_verify },
-  { INS_CHANGE_REFERENCE_DATA, cmd_change_password },
-  { INS_PSO, cmd_pso },
-  { INS_RESET_RETRY_COUNTER, cmd_reset_user_password },
+/*
+ * By default, a command is only allowed when the OpenPGP application
+ * is selected.  These flags allow it for other file selection.
+ */
+#define CMD_ANY_FILE	1	/* Allowed for any file selection */
+#define CMD_TERMINATED	2	/* Allowed even when the card is terminated */
+
+/*
+ * Dispatch table, indexed by INS.  NULL handler means unsupported INS.
+ */
+static const struct command cmds[256] = {
+  [INS_VERIFY] = { cmd_verify, 0 },
+  [INS_CHANGE_REFERENCE_DATA] = { cmd_change_password, 0 },
+  [INS_PSO] = { cmd_pso, 0 },
+  [INS_RESET_RETRY_COUNTER] = { cmd_reset_user_password, 0 },
 #ifdef LIFE_CYCLE_MANAGEMENT_SUPPORT
-  { INS_ACTIVATE_FILE, cmd_activate_file },
+  [INS_ACTIVATE_FILE] = { cmd_activate_file, CMD_ANY_FILE|CMD_TERMINATED },
 #endif
-  { INS_PGP_GENERATE_ASYMMETRIC_KEY_PAIR, cmd_pgp_gakp },
+  [INS_PGP_GENERATE_ASYMMETRIC_KEY_PAIR] = { cmd_pgp_gakp, 0 },
 #ifdef FLASH_UPGRADE_SUPPORT
-  { INS_EXTERNAL_AUTHENTICATE,	            /* Not in OpenPGP card protocol */
-    cmd_external_authenticate },
+  [INS_EXTERNAL_AUTHENTICATE] =		    /* Not in OpenPGP card protocol */
+    { cmd_external_authenticate, CMD_ANY_FILE|CMD_TERMINATED },
 #endif
-  { INS_GET_CHALLENGE, cmd_get_challenge }, /* Not in OpenPGP card protocol */
-  { INS_SET_IDENTITY, cmd_set_identity }, /* Not in OpenPGP card protocol */
-  { INS_INTERNAL_AUTHENTICATE, cmd_internal_authenticate },
-  { INS_SELECT_FILE, cmd_select_file },
-  { INS_READ_BINARY, cmd_read_binary },     /* Not in OpenPGP card protocol */
-  { INS_GET_DATA, cmd_get_data },
-  { INS_WRITE_BINARY, cmd_write_binary},    /* Not in OpenPGP card protocol */
+  [INS_GET_CHALLENGE] =			    /* Not in OpenPGP card protocol */
+    { cmd_get_challenge, CMD_ANY_FILE|CMD_TERMINATED },
+  [INS_SET_IDENTITY] = { cmd_set_identity, 0 }, /* Not in OpenPGP card protocol */
+  [INS_INTERNAL_AUTHENTICATE] = { cmd_internal_authenticate, 0 },
+  [INS_SELECT_FILE] = { cmd_select_file, CMD_ANY_FILE|CMD_TERMINATED },
+  [INS_READ_BINARY] =			    /* Not in OpenPGP card protocol */
+    { cmd_read_binary, CMD_ANY_FILE },
+  [INS_GET_DATA] = { cmd_get_data, 0 },
+  [INS_WRITE_BINARY] =			    /* Not in OpenPGP card protocol */
+    { cmd_write_binary, CMD_ANY_FILE },
 #if defined(CERTDO_SUPPORT)
-  { INS_UPDATE_BINARY, cmd_update_binary }, /* Not in OpenPGP card protocol */
+  [INS_UPDATE_BINARY] =			    /* Not in OpenPGP card protocol */
+    { cmd_update_binary, CMD_ANY_FILE },
 #endif
-  { INS_PUT_DATA, cmd_put_data },
-  { INS_PUT_DATA_ODD, cmd_put_data },
+  [INS_PUT_DATA] = { cmd_put_data, 0 },
+  [INS_PUT_DATA_ODD] = { cmd_put_data, 0 },
 #ifdef LIFE_CYCLE_MANAGEMENT_SUPPORT
-  { INS_TERMINATE_DF, cmd_terminate_df},
+  [INS_TERMINATE_DF] = { cmd_terminate_df, 0 },
 #endif
 };
-#define NUM_CMDS ((int)(sizeof (cmds) / sizeof (struct command)))
 
 static void
 process_command_apdu (struct eventflag *ccid_comm)
 {
-  int i;
   uint8_t cmd = INS (apdu);
+  const struct command *c = &cmds[cmd];
 
-  for (i = 0; i < NUM_CMDS; i++)
-    if (cmds[i].command == cmd)
-      break;
-
-  if (i < NUM_CMDS)
+  if (c->cmd_handler)
     {
       if (file_selection == FILE_CARD_TERMINATED
-	  && cmd != INS_SELECT_FILE && cmd != INS_ACTIVATE_FILE
-	  && cmd != INS_GET_CHALLENGE && cmd != INS_EXTERNAL_AUTHENTICATE)
+	  && !(c->flags & CMD_TERMINATED))
 	GPG_APPLICATION_TERMINATED ();
       else if (file_selection != FILE_DF_OPENPGP
-	       && cmd != INS_SELECT_FILE && cmd != INS_ACTIVATE_FILE
-	       && cmd != INS_GET_CHALLENGE && cmd != INS_EXTERNAL_AUTHENTICATE
-	       && cmd != INS_WRITE_BINARY && cmd != INS_UPDATE_BINARY
-	       && cmd != INS_READ_BINARY)
+	       && !(c->flags & CMD_ANY_FILE))
 	GPG_NO_RECORD ();
       else
 	{
 	  chopstx_setcancelstate (1);
-	  cmds[i].cmd_handler (ccid_comm);
+	  c->cmd_handler (ccid_comm);
 	  chopstx_setcancelstate (0);
 	}
     }
@@ -1614,6 +1662,12 @@ openpgp_card_thread (void *arg)
 #endif
       eventmask_t m = eventflag_wait (openpgp_comm);
 
+      if (m == EV_IDLE)
+	{
+	  flash_data_pool_idle ();
+	  continue;
+	}
+
       DEBUG_INFO ("GPG!: ");
 
       if (m == EV_VERIFY_CMD_AVAILABLE)
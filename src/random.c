@@ -27,10 +27,173 @@
 
 #include "gnuk.h"
 #include "neug.h"
+#include "sha256.h"
+#include "random.h"
 
 #define RANDOM_BYTES_LENGTH 32
 static uint32_t random_word[RANDOM_BYTES_LENGTH/sizeof (uint32_t)];
 
+/*
+ * Hash_DRBG of NIST SP 800-90A with SHA-256, seeded by NeuG.
+ *
+ * NeuG is the entropy source.  It is slow (it conditions its noise
+ * for each 32-byte), so, each consumer has its own DRBG state, which
+ * is instantiated at its first use, and reseeded after
+ * RANDOM_RESEED_INTERVAL requests.
+ *
+ * All consumers are in the card thread, so no lock is needed.
+ */
+#define DRBG_SEEDLEN 55		/* 440-bit for SHA-256 */
+#define DRBG_ENTROPY_LEN 32	/* 256-bit security strength */
+#define DRBG_NONCE_LEN 16
+#define RANDOM_RESEED_INTERVAL 1024
+#define RANDOM_MAX_REQUEST 1024	/* in bytes, for a request */
+
+struct drbg {
+  uint8_t v[DRBG_SEEDLEN];
+  uint8_t c[DRBG_SEEDLEN];
+  uint32_t reseed_counter;	/* 0 when not instantiated yet */
+};
+
+static struct drbg drbg[RANDOM_FOR_NUM];
+static uint8_t random_out[RANDOM_FOR_NUM][RANDOM_BYTES_LENGTH];
+
+static void
+entropy_get (uint8_t *p, int len)
+{
+  uint32_t rnd;
+
+  neug_mode_select (NEUG_MODE_CONDITIONED);
+  for (; len > 0; len -= sizeof (uint32_t), p += sizeof (uint32_t))
+    {
+      rnd = neug_get (NEUG_KICK_FILLING);
+      memcpy (p, &rnd, sizeof (uint32_t));
+    }
+  rnd = 0;
+}
+
+/*
+ * Hash_df: OUT = leftmost 440-bit of
+ *   Hash (1 || 440 || PREFIX || IN0 || IN1) || Hash (2 || ...)
+ * When PREFIX < 0, there is no prefix byte.
+ */
+static void
+hash_df (uint8_t *out, int prefix,
+	 const uint8_t *in0, int len0, const uint8_t *in1, int len1)
+{
+  sha256_context ctx;
+  uint8_t header[5] = { 1, 0, 0, DRBG_SEEDLEN * 8 >> 8,
+			(DRBG_SEEDLEN * 8) & 0xff };
+  uint8_t pre = prefix;
+  uint8_t tmp[SHA256_DIGEST_SIZE];
+
+  sha256_start (&ctx);
+  sha256_update (&ctx, header, sizeof header);
+  if (prefix >= 0)
+    sha256_update (&ctx, &pre, 1);
+  sha256_update (&ctx, in0, len0);
+  sha256_update (&ctx, in1, len1);
+  sha256_finish (&ctx, out);
+
+  header[0] = 2;
+  sha256_start (&ctx);
+  sha256_update (&ctx, header, sizeof header);
+  if (prefix >= 0)
+    sha256_update (&ctx, &pre, 1);
+  sha256_update (&ctx, in0, len0);
+  sha256_update (&ctx, in1, len1);
+  sha256_finish (&ctx, tmp);
+  memcpy (out + SHA256_DIGEST_SIZE, tmp, DRBG_SEEDLEN - SHA256_DIGEST_SIZE);
+  memset (tmp, 0, sizeof tmp);
+}
+
+/* V = V + A (mod 2^440), big endian.  */
+static void
+drbg_add (uint8_t *v, const uint8_t *a, int len)
+{
+  int i, j;
+  unsigned int carry = 0;
+
+  for (i = DRBG_SEEDLEN - 1, j = len - 1; i >= 0; i--, j--)
+    {
+      carry += v[i];
+      if (j >= 0)
+	carry += a[j];
+      v[i] = carry & 0xff;
+      carry >>= 8;
+    }
+}
+
+static void
+drbg_reseed (struct drbg *d, int consumer)
+{
+  uint8_t seed[DRBG_ENTROPY_LEN + DRBG_NONCE_LEN];
+  uint8_t pers = consumer;
+
+  if (d->reseed_counter == 0)
+    {
+      /* Instantiate: entropy || nonce || personalization string */
+      entropy_get (seed, sizeof seed);
+      hash_df (d->v, -1, seed, sizeof seed, &pers, 1);
+    }
+  else
+    {
+      entropy_get (seed, DRBG_ENTROPY_LEN);
+      memcpy (d->c, d->v, DRBG_SEEDLEN);
+      hash_df (d->v, 0x01, d->c, DRBG_SEEDLEN, seed, DRBG_ENTROPY_LEN);
+    }
+
+  hash_df (d->c, 0x00, d->v, DRBG_SEEDLEN, NULL, 0);
+  d->reseed_counter = 1;
+  memset (seed, 0, sizeof seed);
+}
+
+/* LEN should be <= RANDOM_MAX_REQUEST.  */
+static void
+drbg_generate (int consumer, uint8_t *out, size_t len)
+{
+  struct drbg *d = &drbg[consumer];
+  uint8_t data[DRBG_SEEDLEN];
+  uint8_t w[SHA256_DIGEST_SIZE];
+  uint8_t one = 1;
+  uint8_t counter[4];
+  sha256_context ctx;
+  size_t n;
+
+  if (d->reseed_counter == 0 || d->reseed_counter > RANDOM_RESEED_INTERVAL)
+    drbg_reseed (d, consumer);
+
+  /* Hashgen */
+  memcpy (data, d->v, DRBG_SEEDLEN);
+  while (len)
+    {
+      sha256 (data, DRBG_SEEDLEN, w);
+      n = len < SHA256_DIGEST_SIZE ? len : SHA256_DIGEST_SIZE;
+      memcpy (out, w, n);
+      out += n;
+      len -= n;
+      drbg_add (data, &one, 1);
+    }
+
+  /* V = V + Hash (0x03 || V) + C + reseed_counter */
+  data[0] = 0x03;
+  sha256_start (&ctx);
+  sha256_update (&ctx, data, 1);
+  sha256_update (&ctx, d->v, DRBG_SEEDLEN);
+  sha256_finish (&ctx, w);
+  drbg_add (d->v, w, SHA256_DIGEST_SIZE);
+  drbg_add (d->v, d->c, DRBG_SEEDLEN);
+  counter[0] = d->reseed_counter >> 24;
+  counter[1] = d->reseed_counter >> 16;
+  counter[2] = d->reseed_counter >> 8;
+  counter[3] = d->reseed_counter;
+  drbg_add (d->v, counter, 4);
+  d->reseed_counter++;
+
+  memset (data, 0, sizeof data);
+  memset (w, 0, sizeof w);
+}
+
 void
 random_init (void)
 {
@@ -45,17 +208,28 @@ random_init (void)
 void
 random_fini (void)
 {
+  memset (drbg, 0, sizeof drbg);
+  memset (random_out, 0, sizeof random_out);
   neug_fini ();
 }
 
+/*
+ * Return pointer to random 32-byte for CONSUMER
+ */
+const uint8_t *
+random_bytes_get_for (int consumer)
+{
+  drbg_generate (consumer, random_out[consumer], RANDOM_BYTES_LENGTH);
+  return random_out[consumer];
+}
+
 /*
  * Return pointer to random 32-byte
  */
 const uint8_t *
 random_bytes_get (void)
 {
-  neug_wait_full ();
-  return (const uint8_t *)random_word;
+  return random_bytes_get_for (RANDOM_FOR_KEY);
 }
 
 /*
@@ -64,9 +238,17 @@ random_bytes_get (void)
 void
 random_bytes_free (const uint8_t *p)
 {
-  (void)p;
-  memset (random_word, 0, RANDOM_BYTES_LENGTH);
-  neug_flush ();
+  memset ((uint8_t *)p, 0, RANDOM_BYTES_LENGTH);
+}
+
+/*
+ * Force reseeding the DRBG of CONSUMER from NeuG at next request
+ */
+void
+random_reseed (int consumer)
+{
+  if (drbg[consumer].reseed_counter)
+    drbg[consumer].reseed_counter = RANDOM_RESEED_INTERVAL + 1;
 }
 
 /*
@@ -77,44 +259,53 @@ random_get_salt (uint8_t *p)
 {
   uint32_t rnd;
 
+  neug_mode_select (NEUG_MODE_CONDITIONED);
   rnd = neug_get (NEUG_KICK_FILLING);
   memcpy (p, &rnd, sizeof (uint32_t));
   rnd = neug_get (NEUG_KICK_FILLING);
   memcpy (p + sizeof (uint32_t), &rnd, sizeof (uint32_t));
 }
 
+/*
+ * Get LEN bytes of NeuG output directly, in MODE (NEUG_MODE_*).
+ *
+ * The mode is kept after this, and it is switched back to
+ * conditioned mode when entropy is needed by DRBG or salt.
+ */
+void
+random_stream (uint8_t *out, int len, uint8_t mode)
+{
+  uint32_t rnd;
+  int n;
+
+  neug_mode_select (mode);
+  while (len > 0)
+    {
+      rnd = neug_get (NEUG_KICK_FILLING);
+      n = len < (int)sizeof (uint32_t) ? len : (int)sizeof (uint32_t);
+      memcpy (out, &rnd, n);
+      out += n;
+      len -= n;
+    }
+}
+
 
 /*
- * Random byte iterator
+ * Random byte iterator, for prime generation
  */
 int
 random_gen (void *arg, unsigned char *out, size_t out_len)
 {
-  uint8_t *index_p = (uint8_t *)arg;
-  uint8_t index = *index_p;
   size_t n;
 
+  (void)arg;
   while (out_len)
     {
-      neug_wait_full ();
-
-      n = RANDOM_BYTES_LENGTH - index;
-      if (n > out_len)
-	n = out_len;
-
-      memcpy (out, ((unsigned char *)random_word) + index, n);
+      n = out_len < RANDOM_MAX_REQUEST ? out_len : RANDOM_MAX_REQUEST;
+      drbg_generate (RANDOM_FOR_RSA, out, n);
       out += n;
       out_len -= n;
-      index += n;
-
-      if (index >= RANDOM_BYTES_LENGTH)
-	{
-	  index = 0;
-	  neug_flush ();
-	}
     }
 
-  *index_p = index;
-
   return 0;
 }
@@ -1,9 +1,20 @@
 void random_init (void);
 void random_fini (void);
 
+/* Consumers of random bytes, each has its own DRBG */
+#define RANDOM_FOR_KEY       0	/* Key generation, DEK */
+#define RANDOM_FOR_CHALLENGE 1	/* GET CHALLENGE */
+#define RANDOM_FOR_RSA       2	/* Prime generation by random_gen */
+#define RANDOM_FOR_NUM       3
+
 /* 32-byte random bytes */
 const uint8_t *random_bytes_get (void);
+const uint8_t *random_bytes_get_for (int consumer);
 void random_bytes_free (const uint8_t *p);
+void random_reseed (int consumer);
+
+/* Output of NeuG, in NEUG_MODE_* */
+void random_stream (uint8_t *out, int len, uint8_t mode);
 
 /* 8-byte salt */
 void random_get_salt (uint8_t *p);
@@ -223,3 +223,52 @@ sha256 (const unsigned char *input, unsigned int ilen,
   sha256_update (&ctx, input, ilen);
   sha256_finish (&ctx, output);
 }
+
+/*
+ * HMAC-SHA256 (RFC 2104)
+ *
+ * KEYLEN should be <= SHA256_BLOCK_SIZE.
+ */
+void
+hmac_sha256_start (hmac_sha256_context *hctx, const unsigned char *key,
+		   unsigned int keylen)
+{
+  unsigned char ipad[SHA256_BLOCK_SIZE];
+  int i;
+
+  memset (hctx->key, 0, SHA256_BLOCK_SIZE);
+  memcpy (hctx->key, key, keylen);
+  for (i = 0; i < SHA256_BLOCK_SIZE; i++)
+    ipad[i] = hctx->key[i] ^ 0x36;
+
+  sha256_start (&hctx->ctx);
+  sha256_update (&hctx->ctx, ipad, SHA256_BLOCK_SIZE);
+  memset (ipad, 0, SHA256_BLOCK_SIZE);
+}
+
+void
+hmac_sha256_update (hmac_sha256_context *hctx, const unsigned char *input,
+		    unsigned int ilen)
+{
+  sha256_update (&hctx->ctx, input, ilen);
+}
+
+void
+hmac_sha256_finish (hmac_sha256_context *hctx, unsigned char output[32])
+{
+  unsigned char opad[SHA256_BLOCK_SIZE];
+  unsigned char inner[SHA256_DIGEST_SIZE];
+  int i;
+
+  sha256_finish (&hctx->ctx, inner);
+  for (i = 0; i < SHA256_BLOCK_SIZE; i++)
+    opad[i] = hctx->key[i] ^ 0x5c;
+
+  sha256_start (&hctx->ctx);
+  sha256_update (&hctx->ctx, opad, SHA256_BLOCK_SIZE);
+  sha256_update (&hctx->ctx, inner, SHA256_DIGEST_SIZE);
+  sha256_finish (&hctx->ctx, output);
+  memset (opad, 0, SHA256_BLOCK_SIZE);
+  memset (inner, 0, SHA256_DIGEST_SIZE);
+  memset (hctx->key, 0, SHA256_BLOCK_SIZE);
+}
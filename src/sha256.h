@@ -15,3 +15,15 @@ void sha256_finish (sha256_context *ctx, unsigned char output[32]);
 void sha256_update (sha256_context *ctx, const unsigned char *input,
 		    unsigned int ilen);
 void sha256_process (sha256_context *ctx);
+
+typedef struct
+{
+  sha256_context ctx;
+  unsigned char key[SHA256_BLOCK_SIZE];
+} hmac_sha256_context;
+
+void hmac_sha256_start (hmac_sha256_context *hctx, const unsigned char *key,
+			unsigned int keylen);
+void hmac_sha256_update (hmac_sha256_context *hctx,
+			 const unsigned char *input, unsigned int ilen);
+void hmac_sha256_finish (hmac_sha256_context *hctx, unsigned char output[32]);
@@ -46,11 +46,13 @@ struct stdout stdout;
 
 /*
  * USB buffer size of USB-CCID driver
+ *
+ * Header (5-byte), data, and 2-byte room for Le of extended APDU.
  */
 #if MAX_RES_APDU_DATA_SIZE > MAX_CMD_APDU_DATA_SIZE
-#define USB_BUF_SIZE (MAX_RES_APDU_DATA_SIZE+5)
+#define USB_BUF_SIZE (MAX_RES_APDU_DATA_SIZE+5+2)
 #else
-#define USB_BUF_SIZE (MAX_CMD_APDU_DATA_SIZE+5)
+#define USB_BUF_SIZE (MAX_CMD_APDU_DATA_SIZE+5+2)
 #endif
 
 struct apdu apdu;
@@ -136,8 +138,15 @@ static void epo_init (struct ep_out *epo, int ep_num, void *priv)
  *
  * The buffer will be filled by multiple RX packets (Bulk-OUT)
  * or will be used for multiple TX packets (Bulk-IN)
+ *
+ * The command header (5 bytes) is placed at offset 3 of the storage,
+ * so that the data of command and response APDU is word-aligned.
+ * Crypto routines write the result there directly.
  */
-static uint8_t ccid_buffer[USB_BUF_SIZE];
+#define CCID_BUFFER_HEAD_OFFSET 3
+static uint8_t ccid_buffer_storage[CCID_BUFFER_HEAD_OFFSET + USB_BUF_SIZE]
+  __attribute__ ((aligned (4)));
+#define ccid_buffer (&ccid_buffer_storage[CCID_BUFFER_HEAD_OFFSET])
 
 #define CCID_SET_PARAMS		0x61 /* non-ICCD command  */
 #define CCID_POWER_ON		0x62
@@ -192,14 +201,19 @@ struct ccid {
   uint32_t err        : 1;
   uint32_t tx_busy    : 1;
   uint32_t timeout_cnt: 3;
+  uint32_t rx_hold    : 1;	/* Hold the packet received in EXECUTE */
+  uint32_t rx_pending : 1;	/* The packet is held */
 
   uint8_t *p;
   size_t len;
+  uint16_t lc;			/* Lc of the command APDU received */
+  uint8_t rx_pending_len;
 
   struct ccid_header ccid_header;
 
   uint8_t sw1sw2[2];
   uint8_t chained_cls_ins_p1_p2[4];
+  uint8_t ext_len[2];		/* Lc or Le of extended APDU */
 
   /* lower layer */
   struct ep_out *epo;
@@ -252,6 +266,7 @@ static void ccid_reset (struct ccid *c)
   c->state = APDU_STATE_WAIT_COMMAND;
   c->p = c->a->cmd_apdu_data;
   c->len = MAX_CMD_APDU_DATA_SIZE;
+  c->lc = 0;
   c->a->cmd_apdu_data_len = 0;
   c->a->expected_res_size = 0;
 }
@@ -262,9 +277,12 @@ static void ccid_init (struct ccid *c, struct ep_in *epi, struct ep_out *epo,
   c->ccid_state = CCID_STATE_START;
   c->err = 0;
   c->tx_busy = 0;
+  c->rx_hold = 0;
+  c->rx_pending = 0;
   c->state = APDU_STATE_WAIT_COMMAND;
   c->p = a->cmd_apdu_data;
   c->len = MAX_CMD_APDU_DATA_SIZE;
+  c->lc = 0;
   memset (&c->ccid_header, 0, sizeof (struct ccid_header));
   c->sw1sw2[0] = 0x90;
   c->sw1sw2[1] = 0x00;
@@ -496,6 +514,7 @@ static int end_cmd_apdu_head (struct ep_out *epo, size_t orig_len)
       c->len = MAX_CMD_APDU_DATA_SIZE;
     }
 
+  c->lc = 0;
   if (epo->cnt == 4)
     /* No Lc and Le */
     c->a->expected_res_size = 0;
@@ -554,11 +573,84 @@ static int end_cmd_apdu_data (struct ep_out *epo, size_t orig_len)
       return 0;
     }
 
+  c->lc = len;
   c->a->cmd_apdu_data_len += len;
   return 0;
 }
 
 
+/*
+ * Extended APDU: CLS INS P1 P2 00 followed by 2-byte Lc (and data,
+ * then 2-byte Le, optionally), or 2-byte Le only.
+ */
+
+/* Le of extended APDU.  0x0000 means 65536, which is larger than any
+   response, so, it is represented by 0xffff.  */
+static uint16_t
+ext_le (const uint8_t *p)
+{
+  uint16_t le = (p[0] << 8) | p[1];
+
+  return le ? le : 0xffff;
+}
+
+static int end_cmd_apdu_ext_head (struct ep_out *epo, size_t orig_len)
+{
+  struct ccid *c = (struct ccid *)epo->priv;
+
+  if (orig_len == USB_LL_BUF_SIZE
+      && CMD_APDU_HEAD_SIZE + epo->cnt < c->ccid_header.data_len)
+    /* more packet comes */
+    return 1;
+
+  if (CMD_APDU_HEAD_SIZE + epo->cnt != c->ccid_header.data_len
+      || epo->cnt != 2)
+    {
+      epo->err = 1;
+      return 0;
+    }
+
+  /* No Lc but Le */
+  c->a->expected_res_size = ext_le (c->ext_len);
+  c->lc = 0;
+  c->a->cmd_apdu_data_len = 0;
+  return 0;
+}
+
+static int end_cmd_apdu_data_ext (struct ep_out *epo, size_t orig_len)
+{
+  struct ccid *c = (struct ccid *)epo->priv;
+  size_t len = epo->cnt;
+  size_t lc = (c->ext_len[0] << 8) | c->ext_len[1];
+
+  if (orig_len == USB_LL_BUF_SIZE
+      && CMD_APDU_HEAD_SIZE + 2 + len < c->ccid_header.data_len)
+    /* more packet comes */
+    return 1;
+
+  if (CMD_APDU_HEAD_SIZE + 2 + len != c->ccid_header.data_len
+      || lc == 0 || lc > c->len)
+    goto error;
+
+  if (len == lc)
+    /* No Le field*/
+    c->a->expected_res_size = 0;
+  else if (len == lc + 2)
+    /* it has Le field*/
+    c->a->expected_res_size = ext_le (epo->buf - 2);
+  else
+    {
+    error:
+      epo->err = 1;
+      return 0;
+    }
+
+  c->lc = lc;
+  c->a->cmd_apdu_data_len += lc;
+  return 0;
+}
+
+
 static void nomore_data (struct ep_out *epo, size_t len)
 {
   (void)len;
@@ -572,6 +664,18 @@ static void nomore_data (struct ep_out *epo, size_t len)
 
 #define INS_GET_RESPONSE 0xc0
 
+static void ccid_cmd_apdu_data_ext (struct ep_out *epo, size_t len)
+{
+  struct ccid *c = (struct ccid *)epo->priv;
+
+  (void)len;
+  epo->end_rx = end_cmd_apdu_data_ext;
+  epo->buf = c->p;
+  epo->buf_len = c->len + 2;	/* Data and Le */
+  epo->cnt = 0;
+  epo->next_buf = nomore_data;
+}
+
 static void ccid_cmd_apdu_data (struct ep_out *epo, size_t len)
 {
   struct ccid *c = (struct ccid *)epo->priv;
@@ -613,6 +717,18 @@ static void ccid_cmd_apdu_data (struct ep_out *epo, size_t len)
 	}
     }
 
+  if (c->a->cmd_apdu_head[4] == 0
+      && c->ccid_header.data_len > CMD_APDU_HEAD_SIZE)
+    {
+      /* Extended APDU: receive 2-byte Lc (or Le) first */
+      epo->end_rx = end_cmd_apdu_ext_head;
+      epo->buf = c->ext_len;
+      epo->buf_len = 2;
+      epo->cnt = 0;
+      epo->next_buf = ccid_cmd_apdu_data_ext;
+      return;
+    }
+
   epo->end_rx = end_cmd_apdu_data;
   epo->buf = c->p;
   epo->buf_len = c->len;
@@ -649,6 +765,8 @@ static void ccid_abdata (struct ep_out *epo, size_t len)
 static uint8_t endp1_rx_buf[64]; /* Only support single CCID interface.  */
 #endif
 
+static void ccid_rx_ready (uint8_t ep_num, uint16_t len);
+
 static void
 ccid_prepare_receive (struct ccid *c)
 {
@@ -658,6 +776,22 @@ ccid_prepare_receive (struct ccid *c)
   c->epo->cnt = 0;
   c->epo->next_buf = ccid_abdata;
   c->epo->end_rx = end_ccid_rx;
+  if (c->rx_pending)
+    {
+      /* Handle the packet which has been received in EXECUTE.  */
+      c->rx_hold = c->rx_pending = 0;
+      ccid_rx_ready (c->epo->ep_num, c->rx_pending_len);
+      return;
+    }
+  else if (c->rx_hold)
+    {
+      /*
+       * Receive is enabled already.  Don't enable again, as a packet
+       * may be in the endpoint buffer, with its event not yet handled.
+       */
+      c->rx_hold = 0;
+      return;
+    }
 #ifdef GNU_LINUX_EMULATION
   usb_lld_rx_enable_buf (c->epo->ep_num, endp1_rx_buf, 64);
 #else
@@ -666,6 +800,24 @@ ccid_prepare_receive (struct ccid *c)
   DEBUG_INFO ("Rx ready\r\n");
 }
 
+/*
+ * While the command is executed by the application thread, accept
+ * the first packet of next message from the host.  It is held in the
+ * endpoint buffer, until the result of the command is sent and
+ * ccid_prepare_receive is called.  A message of single packet (say,
+ * SELECT, VERIFY, or GET RESPONSE) is received entirely in this way.
+ */
+static void
+ccid_prepare_receive_next (struct ccid *c)
+{
+  c->rx_hold = 1;
+#ifdef GNU_LINUX_EMULATION
+  usb_lld_rx_enable_buf (c->epo->ep_num, endp1_rx_buf, 64);
+#else
+  usb_lld_rx_enable (c->epo->ep_num);
+#endif
+}
+
 /*
  * Rx ready callback
  */
@@ -678,10 +830,19 @@ ccid_rx_ready (uint8_t ep_num, uint16_t len)
    * hard-coded, here.
    */
   struct ep_out *epo = &endpoint_out;
+  struct ccid *c = (struct ccid *)epo->priv;
   int offset = 0;
   int cont;
   size_t orig_len = len;
 
+  if (c->rx_hold)
+    {
+      /* Keep it in the endpoint buffer, see ccid_prepare_receive_next */
+      c->rx_pending = 1;
+      c->rx_pending_len = len;
+      return;
+    }
+
   while (epo->err == 0)
     if (len == 0)
       break;
@@ -1348,7 +1509,7 @@ ccid_handle_data (struct ccid *c)
 		{
 		  if (c->state == APDU_STATE_COMMAND_CHAINING)
 		    {		/* command chaining finished */
-		      c->p += c->a->cmd_apdu_head[4];
+		      c->p += c->lc;
 		      c->a->cmd_apdu_head[4] = 0;
 		      DEBUG_INFO ("CMD chaning finished.\r\n");
 		    }
@@ -1388,8 +1549,8 @@ ccid_handle_data (struct ccid *c)
 		      c->state = APDU_STATE_COMMAND_CHAINING;
 		    }
 
-		  c->p += c->a->cmd_apdu_head[4];
-		  c->len -= c->a->cmd_apdu_head[4];
+		  c->p += c->lc;
+		  c->len -= c->lc;
 		  ccid_send_data_block_0x9000 (c);
 		  DEBUG_INFO ("CMD chaning...\r\n");
 		}
@@ -1519,6 +1680,9 @@ ccid_handle_timeout (struct ccid *c)
     case CCID_STATE_ACK_REQUIRED_1:
       ccid_send_data_block_time_extension (c);
       break;
+    case CCID_STATE_WAIT:
+      eventflag_signal (&c->openpgp_comm, EV_IDLE);
+      break;
     default:
       break;
     }
@@ -1853,7 +2017,12 @@ ccid_thread (void *arg)
 	}
       else if (m == EV_RX_DATA_READY)
 	{
+	  enum ccid_state prev_state = c->ccid_state;
+
 	  c->ccid_state = ccid_handle_data (c);
+	  if (prev_state != CCID_STATE_EXECUTE
+	      && c->ccid_state == CCID_STATE_EXECUTE)
+	    ccid_prepare_receive_next (c);
 	  timeout = 0;
 	  c->timeout_cnt = 0;
 	}
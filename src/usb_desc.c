@@ -141,9 +141,9 @@ static const uint8_t config_desc[] = {
   0xfe, 0, 0, 0,	  /* dwMaxIFSD: 254 */
   0, 0, 0, 0,		  /* dwSynchProtocols: 0 */
   0, 0, 0, 0,		  /* dwMechanical: 0 */
-  0x7a, 0x04, 0x02, 0x00, /* dwFeatures:
-			   *  Short and extended APDU level: 0x40000 ----
-			   *  Short APDU level             : 0x20000  *
+  0x7a, 0x04, 0x04, 0x00, /* dwFeatures:
+			   *  Short and extended APDU level: 0x40000  *
+			   *  Short APDU level             : 0x20000 ----
 			   *  (ICCD?)                      : 0x00800 ----
 			   *  Automatic IFSD               : 0x00400   *
 			   *  NAD value other than 0x00    : 0x00200
@@ -156,7 +156,7 @@ static const uint8_t config_desc[] = {
 			   *  Auto activaction of ICC	   : 0x00004
 			   *  Automatic conf. based on ATR : 0x00002  *
 			   */
-  0x0f, 0x01, 0, 0,	  /* dwMaxCCIDMessageLength: 271 */
+  0x2f, 0x02, 0, 0,	  /* dwMaxCCIDMessageLength: 559 = 10+7+540+2 */
   0xff,			  /* bClassGetResponse: 0xff */
   0x00,			  /* bClassEnvelope: 0 */
   0, 0,			  /* wLCDLayout: 0 */
@@ -211,6 +211,20 @@ class CardReader(object):
         self.increment_seq()
         return self.ccid_get_result()
 
+    def ccid_send_data_block_pipelined(self, data0, data1):
+        # Send two messages, not waiting the result of the first one
+        for data in (data0, data1):
+            msg = ccid_compose(0x6f, self.__seq, data=data)
+            self.__dev.write(self.__bulkout, msg, self.__timeout)
+            self.increment_seq()
+        results = []
+        for i in range(2):
+            status, chain, data_rcv = self.ccid_get_result()
+            while status == 0x80:
+                status, chain, data_rcv = self.ccid_get_result()
+            results.append(data_rcv)
+        return results
+
     def ccid_send_cmd(self, data):
         status, chain, data_rcv = self.ccid_send_data_block(data)
         if chain == 0:
@@ -97,6 +97,18 @@ class Test_Card_Personalize_Card(object):
         r = card.cmd_put_data_odd(0x3f, 0xff, t)
         assert r
 
+    def test_app_data_follows_put_data(self, card):
+        fpr = b'\x01' * 20
+        a = get_data_object(card, 0x6e)
+        try:
+            r = card.cmd_put_data(0x00, 0xc7, fpr)
+            assert r
+            b = get_data_object(card, 0x6e)
+        finally:
+            card.cmd_put_data_remove(0x00, 0xc7)
+        c = get_data_object(card, 0x6e)
+        assert fpr not in a and fpr in b and a == c
+
     def test_fingerprint_1_put(self, card):
         fpr1 = rsa_keys.fpr[0]
         r = card.cmd_put_data(0x00, 0xc7, fpr1)
@@ -0,0 +1,112 @@
+/*
+ * flash-ram.c - Flash ROM in RAM for host checks
+ *
+ * This file is a part of Gnuk, a GnuPG USB Token implementation.
+ *
+ * Gnuk is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Gnuk is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "flash-ram.h"
+
+/* Three pages for keys, and FLASH_RAM_PAGES - 3 pages for data pool.  */
+uint8_t flash_ram[FLASH_RAM_PAGES * FLASH_RAM_PAGE_SIZE]
+  __attribute__ ((aligned (FLASH_RAM_PAGE_SIZE)));
+uint8_t *flash_addr_key_storage_start = flash_ram;
+uint8_t *flash_addr_data_storage_start = flash_ram + 3 * FLASH_RAM_PAGE_SIZE;
+
+uint8_t _identsel;
+uint8_t _selected_identity;
+uint8_t ch_certificate_start;
+
+unsigned long flash_ram_programs;
+unsigned long flash_ram_erases;
+
+static void
+check_range (uintptr_t addr)
+{
+  if (addr < (uintptr_t)flash_ram
+      || addr >= (uintptr_t)flash_ram + sizeof flash_ram)
+    {
+      fprintf (stderr, "flash access out of range: %p\n", (void *)addr);
+      abort ();
+    }
+}
+
+/*
+ * Like STM32F103, a halfword can be programmed only when it's erased,
+ * or to 0x0000.
+ */
+int
+flash_program_halfword (uintptr_t addr, uint16_t data)
+{
+  uint16_t *p = (uint16_t *)addr;
+
+  check_range (addr);
+  if (*p != 0xffff && data != 0)
+    {
+      fprintf (stderr, "flash program error at %lx: %04x -> %04x\n",
+	       (unsigned long)(addr - (uintptr_t)flash_ram), *p, data);
+      abort ();
+    }
+
+  *p = data;
+  flash_ram_programs++;
+  return 0;
+}
+
+int
+flash_erase_page (uintptr_t addr)
+{
+  check_range (addr);
+  memset ((void *)(addr & ~(FLASH_RAM_PAGE_SIZE - 1)), 0xff,
+	  FLASH_RAM_PAGE_SIZE);
+  flash_ram_erases++;
+  return 0;
+}
+
+int
+flash_check_blank (const uint8_t *p_start, size_t size)
+{
+  const uint8_t *p;
+
+  for (p = p_start; p < p_start + size; p++)
+    if (*p != 0xff)
+      return 0;
+
+  return 1;
+}
+
+void
+flash_ram_init (void)
+{
+  memset (flash_ram, 0xff, sizeof flash_ram);
+}
+
+void
+nvic_system_reset (void)
+{
+  abort ();
+}
+
+void
+fatal (uint8_t code)
+{
+  fprintf (stderr, "fatal: %d\n", code);
+  exit (1);
+}
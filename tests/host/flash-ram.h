@@ -0,0 +1,8 @@
+#define FLASH_RAM_PAGE_SIZE 1024
+#define FLASH_RAM_PAGES     7
+
+extern uint8_t flash_ram[];
+extern unsigned long flash_ram_programs;
+extern unsigned long flash_ram_erases;
+
+void flash_ram_init (void);
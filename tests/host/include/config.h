@@ -0,0 +1,2 @@
+/* Configuration for host checks (as GNU/Linux emulation).  */
+#define GNU_LINUX_EMULATION 1
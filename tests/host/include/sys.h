@@ -0,0 +1,16 @@
+/*
+ * Flash ROM interface of sys, for host checks.  It is implemented in
+ * RAM by flash-ram.c.
+ */
+#include <stdint.h>
+#include <stddef.h>
+
+int flash_program_halfword (uintptr_t addr, uint16_t data);
+int flash_erase_page (uintptr_t addr);
+int flash_check_blank (const uint8_t *p_start, size_t size);
+void nvic_system_reset (void);
+
+/* Identity selection and certificate pages are not used by checks.  */
+extern uint8_t _identsel;
+extern uint8_t ch_certificate_start;
+#define FLASH_ADDR_CHCERT_START (&ch_certificate_start)
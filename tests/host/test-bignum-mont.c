@@ -0,0 +1,164 @@
+/*
+ * test-bignum-mont.c - check Montgomery routines of bignum.c
+ *
+ * This file is a part of Gnuk, a GnuPG USB Token implementation.
+ *
+ * Gnuk is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Gnuk is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+ * mpi_exp_mod and mpi_exp_mod_fixed are computed by mpi_montsqr and
+ * mpi_montmul.  Check them against square-and-multiply by mpi_mul_mpi
+ * and mpi_mod_mpi, which don't use Montgomery routines, for moduli of
+ * 1 to 70 limbs, and of 1024-bit and 2048-bit (the fixed size case).
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "polarssl/config.h"
+#include "polarssl/bignum.h"
+
+void *
+gnuk_malloc (size_t size)
+{
+  return malloc (size);
+}
+
+void
+gnuk_free (void *p)
+{
+  free (p);
+}
+
+static void
+random_mpi (mpi *X, size_t size, int odd_full)
+{
+  unsigned char buf[1024];
+  size_t i;
+
+  for (i = 0; i < size; i++)
+    buf[i] = rand ();
+
+  /* Sometimes, use edge values.  */
+  switch (rand () % 8)
+    {
+    case 0:
+      memset (buf, 0xff, size);
+      break;
+    case 1:
+      memset (buf, 0, size);
+      buf[size - 1] = 1;
+      break;
+    default:
+      break;
+    }
+
+  if (odd_full)
+    {				/* Odd, and its MSB is 1 */
+      buf[0] |= 0x80;
+      buf[size - 1] |= 1;
+    }
+
+  mpi_read_binary (X, buf, size);
+}
+
+/* X = A^E mod N, by mpi_mul_mpi and mpi_mod_mpi.  */
+static void
+exp_mod_ref (mpi *X, const mpi *A, const mpi *E, const mpi *N)
+{
+  mpi T;
+  int i;
+
+  mpi_init (&T);
+  mpi_lset (X, 1);
+  for (i = mpi_msb (E) - 1; i >= 0; i--)
+    {
+      mpi_mul_mpi (&T, X, X);
+      mpi_mod_mpi (X, &T, N);
+      if (mpi_get_bit (E, i))
+	{
+	  mpi_mul_mpi (&T, X, A);
+	  mpi_mod_mpi (X, &T, N);
+	}
+    }
+  mpi_free (&T);
+}
+
+static int
+check (size_t nbytes, int fixed)
+{
+  mpi N, A, E, X, R;
+  int r;
+
+  mpi_init (&N); mpi_init (&A); mpi_init (&E); mpi_init (&X); mpi_init (&R);
+
+  random_mpi (&N, nbytes, 1);
+  random_mpi (&A, nbytes, 0);
+  mpi_mod_mpi (&A, &A, &N);
+  random_mpi (&E, 1 + rand () % 8, 0);
+
+  if (fixed)
+    mpi_exp_mod_fixed (&X, &A, &E, &N, NULL);
+  else
+    mpi_exp_mod (&X, &A, &E, &N, NULL);
+  exp_mod_ref (&R, &A, &E, &N);
+  r = mpi_cmp_mpi (&X, &R);
+
+  mpi_free (&N); mpi_free (&A); mpi_free (&E); mpi_free (&X); mpi_free (&R);
+  return r != 0;
+}
+
+int
+main (int argc, char *argv[])
+{
+  size_t limbs;
+  int i;
+  int failures = 0;
+
+  (void)argc; (void)argv;
+
+  for (limbs = 1; limbs <= 70; limbs++)
+    for (i = 0; i < 100; i++)
+      if (check (limbs * sizeof (t_uint), 0))
+	{
+	  printf ("FAIL: mpi_exp_mod, %d-limb\n", (int)limbs);
+	  failures++;
+	}
+
+  for (i = 0; i < 100; i++)
+    {
+      if (check (128, 1))
+	{
+	  printf ("FAIL: mpi_exp_mod_fixed, 1024-bit\n");
+	  failures++;
+	}
+      if (check (256, 1))
+	{
+	  printf ("FAIL: mpi_exp_mod_fixed, 2048-bit\n");
+	  failures++;
+	}
+    }
+
+  if (failures)
+    {
+      printf ("%d failure(s)\n", failures);
+      return 1;
+    }
+
+  printf ("bignum Montgomery routines: OK\n");
+  return 0;
+}
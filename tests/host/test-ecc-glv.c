@@ -0,0 +1,196 @@
+/*
+ * test-ecc-glv.c - check GLV scalar multiplication of secp256k1
+ *
+ * This file is a part of Gnuk, a GnuPG USB Token implementation.
+ *
+ * Gnuk is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Gnuk is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+ * compute_kP_p256k1 (by GLV endomorphism) is compared with plain
+ * double-and-add by jpc_double and jpc_add_ac, for the scalars 1, 2,
+ * N-2, N-1, LAMBDA, LAMBDA+1, and random ones, on G and on random
+ * points.  Random scalars should cover all four combinations of the
+ * signs of K1 and K2 by glv_split.
+ *
+ * ec_p256k1.c is included here to access static functions of ecc.c.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "ec_p256k1.c"
+
+#define RANDOM_SCALARS 500
+#define RANDOM_POINTS 4
+
+static const char *lambda =
+  "5363ad4cc05c30e0a5261c028812645a122e22ea20816678df02967c1b23bd72";
+
+static const ac G[1] = {
+  {
+    {{{ 0x16f81798, 0x59f2815b, 0x2dce28d9, 0x029bfcdb,
+	0xce870b07, 0x55a06295, 0xf9dcbbac, 0x79be667e }}},
+    {{{ 0xfb10d4b8, 0x9c47d08f, 0xa6855419, 0xfd17b448,
+	0x0e1108a8, 0x5da4fbfc, 0x26a3c465, 0x483ada77 }}}
+  }
+};
+
+/* Not used, as there is no signature here.  */
+void
+bn256_random (bn256 *X)
+{
+  (void)X;
+  abort ();
+}
+
+static void
+bn256_from_hex (bn256 *X, const char *hex)
+{
+  int i;
+
+  memset (X, 0, sizeof (bn256));
+  for (i = 0; i < 64; i++)
+    {
+      int c = hex[63 - i];
+      uint32_t v = c <= '9' ? c - '0' : c - 'a' + 10;
+
+      X->word[i / 8] |= v << ((i % 8) * 4);
+    }
+}
+
+static uint32_t rnd_state = 2463534242UL;
+
+static uint32_t
+rnd (void)
+{
+  rnd_state ^= rnd_state << 13;
+  rnd_state ^= rnd_state >> 17;
+  rnd_state ^= rnd_state << 5;
+  return rnd_state;
+}
+
+/* Random K, where 1 <= K <= N - 1.  */
+static void
+random_scalar (bn256 *K)
+{
+  bn256 tmp[1];
+  int i;
+
+  do
+    for (i = 0; i < BN256_WORDS; i++)
+      K->word[i] = rnd ();
+  while (bn256_is_zero (K) || bn256_sub (tmp, K, N) == 0);
+}
+
+/* X = K * P, by plain double-and-add, from the most significant bit.  */
+static int
+compute_kP_plain (ac *X, const bn256 *K, const ac *P)
+{
+  jpc Q[1];
+  int i;
+
+  memset (Q->z, 0, sizeof (bn256)); /* infinity */
+  for (i = 255; i >= 0; i--)
+    {
+      FUNC(jpc_double) (Q, Q);
+      if ((K->word[i / 32] >> (i % 32)) & 1)
+	FUNC(jpc_add_ac) (Q, Q, P);
+    }
+
+  return FUNC(jpc_to_ac) (X, Q);
+}
+
+static int
+check (const bn256 *K, const ac *P)
+{
+  ac X[1], Y[1];
+  int i;
+
+  if (compute_kP_p256k1 (X, K, P) == 0
+      && compute_kP_plain (Y, K, P) == 0
+      && bn256_cmp (X->x, Y->x) == 0 && bn256_cmp (X->y, Y->y) == 0)
+    return 0;
+
+  printf ("FAIL: K=");
+  for (i = BN256_WORDS - 1; i >= 0; i--)
+    printf ("%08x", K->word[i]);
+  printf (", P.x=");
+  for (i = BN256_WORDS - 1; i >= 0; i--)
+    printf ("%08x", P->x->word[i]);
+  printf ("\n");
+  return 1;
+}
+
+int
+main (int argc, char *argv[])
+{
+  ac P[RANDOM_POINTS + 1];
+  bn256 K[1], L[1];
+  int signs_seen[4] = { 0, 0, 0, 0 };
+  int i, j;
+  int failures = 0;
+
+  (void)argc; (void)argv;
+
+  memcpy (&P[0], G, sizeof (ac));
+  for (j = 1; j <= RANDOM_POINTS; j++)
+    {
+      random_scalar (K);
+      compute_kG_p256k1 (&P[j], K);
+    }
+
+  bn256_from_hex (L, lambda);
+  for (j = 0; j <= RANDOM_POINTS; j++)
+    {
+      memset (K, 0, sizeof (bn256));
+      K->word[0] = 1;
+      failures += check (K, &P[j]);
+      K->word[0] = 2;
+      failures += check (K, &P[j]);
+      bn256_sub_uint (K, N, 2);
+      failures += check (K, &P[j]);
+      bn256_sub_uint (K, N, 1);
+      failures += check (K, &P[j]);
+      failures += check (L, &P[j]);
+      bn256_add_uint (K, L, 1);
+      failures += check (K, &P[j]);
+
+      for (i = 0; i < RANDOM_SCALARS; i++)
+	{
+	  bn256 K1[1], K2[1];
+	  uint32_t k1_neg, k2_neg;
+
+	  random_scalar (K);
+	  glv_split (K1, &k1_neg, K2, &k2_neg, K);
+	  signs_seen[k1_neg * 2 + k2_neg]++;
+	  failures += check (K, &P[j]);
+	}
+    }
+
+  for (i = 0; i < 4; i++)
+    if (signs_seen[i] == 0)
+      {
+	printf ("FAIL: no scalar with K1 %s and K2 %s\n",
+		i & 2 ? "negative" : "positive",
+		i & 1 ? "negative" : "positive");
+	failures++;
+      }
+
+  if (failures)
+    return 1;
+
+  printf ("secp256k1 GLV scalar multiplication: OK\n");
+  return 0;
+}
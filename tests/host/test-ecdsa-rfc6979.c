@@ -0,0 +1,163 @@
+/*
+ * test-ecdsa-rfc6979.c - check deterministic ECDSA of ecc.c
+ *
+ * This file is a part of Gnuk, a GnuPG USB Token implementation.
+ *
+ * Gnuk is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Gnuk is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+ * Known answers of RFC 6979 A.2.5 (P-256, SHA-256) for the messages
+ * "sample" and "test": both of K by rfc6979_init/rfc6979_generate,
+ * and of (r,s) by ecdsa_p256r1.  Besides, with additional data, K
+ * should differ from the one without.  The hedged values were
+ * computed independently, by HMAC_DRBG of RFC 6979 with k' appended.
+ *
+ * ec_p256r1.c is included here to access static functions of ecc.c.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "ec_p256r1.c"
+
+static const char *priv =
+  "c9afa9d845ba75166b5c215767b1d6934e50c3db36e89b127b8a622b120f6721";
+
+static const struct {
+  const char *msg;
+  const char *k;
+  const char *r;
+  const char *s;
+} kat[] = {
+  { "sample",
+    "a6e3c57dd01abe90086538398355dd4c3b17aa873382b0f24d6129493d8aad60",
+    "efd48b2aacb6a8fd1140dd9cd45e81d69d2c877b56aaf991c34d0ea84eaf3716",
+    "f7cb1c942d657c41d436c7a1b6e29f65f3e900dbb9aff4064dc4ab2f843acda8" },
+  { "test",
+    "d16b6ae827f17175e040871a1c7ec3500192c4c92677336ec2537acaee0008e0",
+    "f1abb023518351cd71d881567b1ea663ed3efcf6c5132b354f28d3b0b7d38367",
+    "019f4113742a2b14bd25926b49c649155f267e60d3814b4c0cc84250e46f0083" },
+};
+
+/* K, r and s for "sample", with EXTRA = 01 02 ... 08 as k' of 3.6.  */
+static const uint8_t extra[8] = { 1, 2, 3, 4, 5, 6, 7, 8 };
+static const char *k_hedged =
+  "b6d0c86004bb200bb0d6fe4fa7871b33fe0d63a5ae9e39d5ec6efc720a748a17";
+static const char *r_hedged =
+  "317ad0dedf5b349d9870b7410a6e56c0c9e42e665459faa38bd267c3f94d5ec9";
+static const char *s_hedged =
+  "2c378313b6a3fd31d8ae0689073abeeafc08b6c7bf280fd0bc5fa4415edc979b";
+
+/* Not used, as all signatures here are deterministic.  */
+void
+bn256_random (bn256 *X)
+{
+  (void)X;
+  abort ();
+}
+
+static void
+bn256_from_hex (bn256 *X, const char *hex)
+{
+  int i;
+
+  memset (X, 0, sizeof (bn256));
+  for (i = 0; i < 64; i++)
+    {
+      int c = hex[63 - i];
+      uint32_t v = c <= '9' ? c - '0' : c - 'a' + 10;
+
+      X->word[i / 8] |= v << ((i % 8) * 4);
+    }
+}
+
+/* Hash of MSG as the integer Z, the way call-ec.c does.  */
+static void
+hash_to_bn256 (bn256 *Z, const char *msg)
+{
+  uint8_t h[32];
+  uint8_t *p = (uint8_t *)Z;
+  int i;
+
+  sha256 ((const unsigned char *)msg, strlen (msg), h);
+  for (i = 0; i < 32; i++)
+    p[i] = h[31 - i];
+}
+
+static int
+expect (const char *what, const char *msg, const bn256 *X, const char *hex)
+{
+  bn256 e;
+  int i;
+
+  bn256_from_hex (&e, hex);
+  if (bn256_cmp (X, &e) == 0)
+    return 0;
+
+  printf ("FAIL: %s, \"%s\": ", what, msg);
+  for (i = BN256_WORDS - 1; i >= 0; i--)
+    printf ("%08x", X->word[i]);
+  printf ("\n");
+  return 1;
+}
+
+int
+main (int argc, char *argv[])
+{
+  bn256 d, z, k, k0, r, s;
+  rfc6979_state st;
+  size_t i;
+  int failures = 0;
+
+  (void)argc; (void)argv;
+
+  bn256_from_hex (&d, priv);
+
+  for (i = 0; i < sizeof kat / sizeof kat[0]; i++)
+    {
+      hash_to_bn256 (&z, kat[i].msg);
+
+      rfc6979_init (&st, &z, &d, NULL, 0);
+      rfc6979_generate (&st, &k);
+      failures += expect ("k", kat[i].msg, &k, kat[i].k);
+
+      ecdsa_p256r1 (&r, &s, &z, &d, 1, NULL, 0);
+      failures += expect ("r", kat[i].msg, &r, kat[i].r);
+      failures += expect ("s", kat[i].msg, &s, kat[i].s);
+    }
+
+  /* Hedged: K should not be the one of RFC 6979.  */
+  hash_to_bn256 (&z, kat[0].msg);
+  bn256_from_hex (&k0, kat[0].k);
+
+  rfc6979_init (&st, &z, &d, extra, sizeof extra);
+  rfc6979_generate (&st, &k);
+  if (bn256_cmp (&k, &k0) == 0)
+    {
+      printf ("FAIL: hedged k is same as deterministic k\n");
+      failures++;
+    }
+  failures += expect ("hedged k", kat[0].msg, &k, k_hedged);
+
+  ecdsa_p256r1 (&r, &s, &z, &d, 1, extra, sizeof extra);
+  failures += expect ("hedged r", kat[0].msg, &r, r_hedged);
+  failures += expect ("hedged s", kat[0].msg, &s, s_hedged);
+
+  if (failures)
+    return 1;
+
+  printf ("RFC 6979 ECDSA: OK\n");
+  return 0;
+}
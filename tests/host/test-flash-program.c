@@ -0,0 +1,121 @@
+/*
+ * test-flash-program.c - check flash_program_buffer of flash.c
+ *
+ * This file is a part of Gnuk, a GnuPG USB Token implementation.
+ *
+ * Gnuk is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Gnuk is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+ * Program runs of 0..9 bytes by flash_program_buffer, and DOs of
+ * 0..9 bytes by flash_do_write_internal.  An odd last byte should be
+ * padded by 0xff, and nothing after the run should be programmed.
+ * flash_write_binary should reject odd length, as before.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "config.h"
+#include "sys.h"
+#include "gnuk.h"
+#include "flash-ram.h"
+
+struct key_data kd[3];
+const uint8_t openpgpcard_aid[14];
+
+int
+gpg_get_algo_attr_key_size (enum kind_of_key kk, enum size_of_key s)
+{
+  (void)kk; (void)s;
+  return 512;
+}
+
+void gpg_data_copy (const uint8_t *p) { (void)p; }
+int gpg_data_live_size (void) { return 0; }
+void gpg_do_bump_generation (void) { }
+
+static int failures;
+
+/* Check that P has DATA of LEN bytes, then 0xff for the rest.  */
+static void
+check_run (const char *what, const uint8_t *p, const uint8_t *data, int len,
+	   unsigned long programs)
+{
+  int i;
+
+  for (i = 0; i < len; i++)
+    if (p[i] != data[i])
+      break;
+
+  if (i != len || p[len] != 0xff || p[len + 1] != 0xff
+      || p[len + 2] != 0xff || flash_ram_programs != programs)
+    {
+      printf ("FAIL: %s of %d bytes: ", what, len);
+      for (i = 0; i < len + 3; i++)
+	printf ("%02x", p[i]);
+      printf (", %lu programs\n", flash_ram_programs);
+      failures++;
+    }
+}
+
+int
+main (int argc, char *argv[])
+{
+  uint8_t data[10];
+  uint8_t *p = flash_ram + 3 * FLASH_RAM_PAGE_SIZE;
+  int len;
+
+  (void)argc; (void)argv;
+
+  for (len = 0; len < (int)sizeof data; len++)
+    data[len] = 0x10 + len;
+
+  for (len = 0; len < (int)sizeof data; len++)
+    {
+      flash_ram_init ();
+      flash_ram_programs = 0;
+      if (flash_program_buffer ((uintptr_t)p, data, len) != 0)
+	{
+	  printf ("FAIL: flash_program_buffer of %d bytes\n", len);
+	  failures++;
+	}
+      check_run ("flash_program_buffer", p, data, len, (len + 1) / 2);
+
+      flash_ram_init ();
+      flash_ram_programs = 0;
+      flash_do_write_internal (p, 0x42, data, len);
+      if (p[0] != 0x42 || p[1] != len)
+	{
+	  printf ("FAIL: flash_do_write_internal header of %d bytes\n", len);
+	  failures++;
+	}
+      check_run ("flash_do_write_internal", p + 2, data, len,
+		 1 + (len + 1) / 2);
+    }
+
+  if (flash_write_binary (FILEID_SERIAL_NO, data, 3, 0) != -1)
+    {
+      printf ("FAIL: flash_write_binary accepts odd length\n");
+      failures++;
+    }
+
+  if (failures)
+    return 1;
+
+  printf ("flash programming of odd length: OK\n");
+  return 0;
+}
@@ -0,0 +1,167 @@
+/*
+ * test-hash-drbg.c - check Hash_DRBG of random.c
+ *
+ * This file is a part of Gnuk, a GnuPG USB Token implementation.
+ *
+ * Gnuk is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Gnuk is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+ * The first vector is of NIST CAVP (Hash_DRBG.rsp, SHA-256, no
+ * prediction resistance, no personalization string, no additional
+ * input, COUNT = 0): instantiate, generate 1024-bit twice, and the
+ * second output is the answer.  Since random.c always instantiates
+ * with a personalization string, the state is set up by hash_df here,
+ * and it checks hash_df and drbg_generate.
+ *
+ * Then, instantiation and reseed by drbg_reseed are checked with
+ * entropy from NeuG replaced by the stub below.  Those answers were
+ * computed independently, by an implementation of SP 800-90A 10.1.1.
+ *
+ * random.c is included here to access its static functions.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "../../src/random.c"
+
+static const char *cavp_entropy =
+  "a65ad0f345db4e0effe875c3a2e71f42c7129d620ff5c119a9ef55f05185e0fb";
+static const char *cavp_nonce = "8581f9317517276e06e9607ddbcbcc2e";
+static const char *cavp_returned =
+  "d3e160c35b99f340b2628264d1751060e0045da383ff57a57d73a673d2b8d80d"
+  "aaf6a6c35a91bb4579d73fd0c8fed111b0391306828adfed528f018121b3febd"
+  "c343e797b87dbb63db1333ded9d1ece177cfa6b71fe8ab1da46624ed6415e51c"
+  "cde2c7ca86e283990eeaeb91120415528b2295910281b02dd431f4c9f70427df";
+
+/*
+ * RANDOM_FOR_KEY instantiated by entropy || nonce = 20 21 ... 4f,
+ * then, reseeded by entropy = 60 61 ... 7f.
+ */
+static const char *instantiated =
+  "0f158090ca3bf7750e129b6d28345940a5173aec2ad522141caccf612fe99803";
+static const char *reseeded =
+  "06526974ec5fffb418d9b2afcb8f2a3126ff22b8af418a4579e1b792f7f32efd";
+
+/* NeuG stub: returns bytes from NEUG_FEED, in order.  */
+static uint8_t neug_feed[64];
+static int neug_feed_index;
+
+void
+neug_mode_select (uint8_t mode)
+{
+  (void)mode;
+}
+
+uint32_t
+neug_get (int kick)
+{
+  uint32_t v;
+
+  (void)kick;
+  if (neug_feed_index + sizeof (uint32_t) > sizeof neug_feed)
+    abort ();
+  memcpy (&v, neug_feed + neug_feed_index, sizeof (uint32_t));
+  neug_feed_index += sizeof (uint32_t);
+  return v;
+}
+
+void
+neug_init (uint32_t *buf, uint8_t size)
+{
+  (void)buf; (void)size;
+}
+
+void
+neug_fini (void)
+{
+}
+
+static void
+from_hex (uint8_t *out, const char *hex, int len)
+{
+  int i;
+
+  for (i = 0; i < len * 2; i++)
+    {
+      int c = hex[i];
+      uint8_t v = c <= '9' ? c - '0' : c - 'a' + 10;
+
+      if ((i & 1) == 0)
+	out[i / 2] = v << 4;
+      else
+	out[i / 2] |= v;
+    }
+}
+
+static int
+expect (const char *what, const uint8_t *out, const char *hex, int len)
+{
+  uint8_t e[128];
+  int i;
+
+  from_hex (e, hex, len);
+  if (memcmp (out, e, len) == 0)
+    return 0;
+
+  printf ("FAIL: %s: ", what);
+  for (i = 0; i < len; i++)
+    printf ("%02x", out[i]);
+  printf ("\n");
+  return 1;
+}
+
+int
+main (int argc, char *argv[])
+{
+  struct drbg *d = &drbg[RANDOM_FOR_CHALLENGE];
+  uint8_t seed[DRBG_ENTROPY_LEN + DRBG_NONCE_LEN];
+  uint8_t out[128];
+  int i;
+  int failures = 0;
+
+  (void)argc; (void)argv;
+
+  /* Instantiate, as SP 800-90A 10.1.1.2 without personalization.  */
+  from_hex (seed, cavp_entropy, DRBG_ENTROPY_LEN);
+  from_hex (seed + DRBG_ENTROPY_LEN, cavp_nonce, DRBG_NONCE_LEN);
+  hash_df (d->v, -1, seed, sizeof seed, NULL, 0);
+  hash_df (d->c, 0x00, d->v, DRBG_SEEDLEN, NULL, 0);
+  d->reseed_counter = 1;
+
+  drbg_generate (RANDOM_FOR_CHALLENGE, out, sizeof out);
+  drbg_generate (RANDOM_FOR_CHALLENGE, out, sizeof out);
+  failures += expect ("CAVP COUNT=0", out, cavp_returned, sizeof out);
+
+  /* Instantiate and reseed by drbg_reseed, with entropy from NeuG.  */
+  for (i = 0; i < DRBG_ENTROPY_LEN + DRBG_NONCE_LEN; i++)
+    neug_feed[i] = 0x20 + i;
+  neug_feed_index = 0;
+  drbg_generate (RANDOM_FOR_KEY, out, RANDOM_BYTES_LENGTH);
+  failures += expect ("instantiate", out, instantiated, RANDOM_BYTES_LENGTH);
+
+  for (i = 0; i < DRBG_ENTROPY_LEN; i++)
+    neug_feed[i] = 0x60 + i;
+  neug_feed_index = 0;
+  random_reseed (RANDOM_FOR_KEY);
+  drbg_generate (RANDOM_FOR_KEY, out, RANDOM_BYTES_LENGTH);
+  failures += expect ("reseed", out, reseeded, RANDOM_BYTES_LENGTH);
+
+  if (failures)
+    return 1;
+
+  printf ("Hash_DRBG: OK\n");
+  return 0;
+}
@@ -0,0 +1,168 @@
+/*
+ * test-key-alloc.c - check key storage allocation of flash.c
+ *
+ * This file is a part of Gnuk, a GnuPG USB Token implementation.
+ *
+ * Gnuk is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Gnuk is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+ * The storage size of an RSA key changes, when the firmware is built
+ * with --enable-rsa-crt-storage (512 -> 1024 for RSA-2048), and when
+ * it is disabled again.  Replace (and delete, then import) a key in
+ * the key page, the way gpg_do_write_prvkey does, while the size
+ * changes.  Each time, the new key should be allocated and it should
+ * be found by flash_key_storage_init.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "config.h"
+#include "sys.h"
+#include "gnuk.h"
+#include "flash-ram.h"
+
+struct key_data kd[3];
+const uint8_t openpgpcard_aid[14];
+
+/* Key sizes of the key for signing, instead of algorithm attributes.  */
+static int key_size_storage = 512;
+static int key_size_private = 256;
+
+int
+gpg_get_algo_attr_key_size (enum kind_of_key kk, enum size_of_key s)
+{
+  (void)kk;
+  if (s == GPG_KEY_STORAGE)
+    return key_size_storage;
+  else
+    return key_size_private;
+}
+
+void gpg_data_copy (const uint8_t *p) { (void)p; }
+int gpg_data_live_size (void) { return 0; }
+void gpg_do_bump_generation (void) { }
+
+static uint8_t *key_addr;	/* Address of the key, NULL if none */
+static int key_addr_size;	/* Its storage size */
+static int failures;
+
+static void
+key_delete (void)
+{
+  if (key_addr)
+    flash_key_release (key_addr, key_addr_size);
+  key_addr = NULL;
+  kd[GPG_KEY_FOR_SIGNING].pubkey = NULL;
+}
+
+/*
+ * Delete the key (if any), and import new key with the storage size
+ * STORAGE, of which private key size is PRIVATE.
+ */
+static void
+key_import (int storage, int private, const char *what)
+{
+  uint8_t key[2048];
+  int len = storage - 32;	/* Some padding is left as 0xff.  */
+  int i;
+
+  key_delete ();
+
+  key_size_storage = storage;
+  key_size_private = private;
+  for (i = 0; i < len; i++)
+    key[i] = 1 + rand () % 254;
+
+  key_addr = flash_key_alloc (GPG_KEY_FOR_SIGNING);
+  if (key_addr == NULL)
+    {
+      printf ("FAIL: %s: no space for a key of %d\n", what, storage);
+      failures++;
+      return;
+    }
+
+  key_addr_size = storage;
+  flash_key_write (key_addr, key, private, key + private, len - private);
+
+  /* Boot time */
+  flash_key_storage_init ();
+  if (kd[GPG_KEY_FOR_SIGNING].pubkey != key_addr + private)
+    {
+      printf ("FAIL: %s: key of %d at %d is not found\n", what, storage,
+	      (int)(key_addr - flash_ram));
+      failures++;
+    }
+}
+
+static void
+check_change (int size0, int size1, int private)
+{
+  const uint8_t *do_start, *do_end;
+  char what[64];
+  int i;
+
+  for (i = 0; i < 4; i++)
+    {
+      flash_ram_init ();
+      key_addr = NULL;
+      flash_do_storage_init (&do_start, &do_end);
+
+      /* A key of SIZE0 is there, replace it by keys of SIZE1.  */
+      sprintf (what, "replace %d->%d #%d", size0, size1, i);
+      key_import (size0, private, what);
+      key_import (size1, private, what);
+      key_import (size1, private, what);
+      key_import (size1, private, what);
+
+      /* And back to SIZE0.  */
+      sprintf (what, "replace %d->%d #%d", size1, size0, i);
+      key_import (size0, private, what);
+      key_import (size0, private, what);
+
+      /* Delete a key, then import a key of another size.  */
+      sprintf (what, "delete and import %d->%d #%d", size0, size1, i);
+      key_delete ();
+      key_import (size1, private, what);
+      key_delete ();
+      key_import (size0, private, what);
+      key_import (size0, private, what);
+      key_delete ();
+      key_import (size1, private, what);
+    }
+}
+
+int
+main (int argc, char *argv[])
+{
+  (void)argc; (void)argv;
+
+  /* RSA-2048 with and without CRT parameters, in a 1 KiB page.  */
+  check_change (512, 1024, 256);
+  /* Same for smaller keys, so that a page has multiple slots.  */
+  check_change (256, 512, 128);
+  check_change (128, 256, 64);
+
+  if (failures)
+    {
+      printf ("%d failure(s)\n", failures);
+      return 1;
+    }
+
+  printf ("key storage allocation: OK\n");
+  return 0;
+}
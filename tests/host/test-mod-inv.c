@@ -0,0 +1,195 @@
+/*
+ * test-mod-inv.c - check modular inversion of mod.c
+ *
+ * This file is a part of Gnuk, a GnuPG USB Token implementation.
+ *
+ * Gnuk is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Gnuk is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+ * For the prime fields and the group orders used by Gnuk, check that
+ * X * mod_inv (X) == 1 (mod N), and same for mod_inv_vartime, by
+ * plain shift-and-subtract reduction.  Inputs are X=0, 1, N-1, and
+ * numbers up to 2^256-1, which are not reduced by N.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "bn.h"
+#include "mod.h"
+
+static const struct {
+  const char *name;
+  const char *hex;
+} modulus[] = {
+  { "p256r1",
+    "ffffffff00000001000000000000000000000000ffffffffffffffffffffffff" },
+  { "n256r1",
+    "ffffffff00000000ffffffffffffffffbce6faada7179e84f3b9cac2fc632551" },
+  { "p256k1",
+    "fffffffffffffffffffffffffffffffffffffffffffffffffffffffefffffc2f" },
+  { "n256k1",
+    "fffffffffffffffffffffffffffffffebaaedce6af48a03bbfd25e8cd0364141" },
+  { "p25519",
+    "7fffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffed" },
+  { "n25519",
+    "1000000000000000000000000000000014def9dea2f79cd65812631a5cf5d3ed" },
+};
+
+static void
+bn256_from_hex (bn256 *X, const char *hex)
+{
+  int i;
+
+  memset (X, 0, sizeof (bn256));
+  for (i = 0; i < 64; i++)
+    {
+      int c = hex[63 - i];
+      uint32_t v = c <= '9' ? c - '0' : c - 'a' + 10;
+
+      X->word[i / 8] |= v << ((i % 8) * 4);
+    }
+}
+
+static uint32_t rnd_state = 2463534242UL;
+
+static uint32_t
+rnd (void)
+{
+  rnd_state ^= rnd_state << 13;
+  rnd_state ^= rnd_state >> 17;
+  rnd_state ^= rnd_state << 5;
+  return rnd_state;
+}
+
+/* R = A mod N, where A is of NWORDS, bit by bit.  */
+static void
+reduce (bn256 *R, const uint32_t *a, int nwords, const bn256 *N)
+{
+  int i;
+
+  memset (R, 0, sizeof (bn256));
+  for (i = nwords * 32 - 1; i >= 0; i--)
+    {
+      uint32_t carry = bn256_shift (R, R, 1);
+
+      R->word[0] |= (a[i / 32] >> (i % 32)) & 1;
+      if (carry || bn256_is_ge (R, N))
+	bn256_sub (R, R, N);
+    }
+}
+
+/* Return 0 when C is the inverse of X, or X = 0 and C = 0.  */
+static int
+check_inverse (const bn256 *X, const bn256 *C, const bn256 *N)
+{
+  bn256 x, c, one;
+  bn512 t;
+
+  if (bn256_is_ge (C, N))
+    return 1;			/* Not reduced */
+
+  reduce (&x, X->word, BN256_WORDS, N);
+  if (bn256_is_zero (&x))
+    return !bn256_is_zero (C);
+
+  bn256_mul (&t, &x, C);
+  reduce (&c, t.word, BN512_WORDS, N);
+  memset (&one, 0, sizeof (bn256));
+  one.word[0] = 1;
+  return bn256_cmp (&c, &one) != 0;
+}
+
+static int
+check (const char *name, const bn256 *X, const bn256 *N)
+{
+  bn256 c;
+  int failures = 0;
+  int i;
+
+  mod_inv (&c, X, N);
+  if (check_inverse (X, &c, N))
+    {
+      printf ("FAIL: mod_inv, %s, X=", name);
+      for (i = BN256_WORDS - 1; i >= 0; i--)
+	printf ("%08x", X->word[i]);
+      printf ("\n");
+      failures++;
+    }
+
+  mod_inv_vartime (&c, X, N);
+  if (check_inverse (X, &c, N))
+    {
+      printf ("FAIL: mod_inv_vartime, %s, X=", name);
+      for (i = BN256_WORDS - 1; i >= 0; i--)
+	printf ("%08x", X->word[i]);
+      printf ("\n");
+      failures++;
+    }
+
+  return failures;
+}
+
+int
+main (int argc, char *argv[])
+{
+  size_t m;
+  int i, j;
+  int failures = 0;
+
+  (void)argc; (void)argv;
+
+  for (m = 0; m < sizeof modulus / sizeof modulus[0]; m++)
+    {
+      bn256 N, X;
+
+      bn256_from_hex (&N, modulus[m].hex);
+
+      memset (&X, 0, sizeof (bn256));
+      failures += check (modulus[m].name, &X, &N);
+      X.word[0] = 1;
+      failures += check (modulus[m].name, &X, &N);
+      bn256_sub_uint (&X, &N, 1);
+      failures += check (modulus[m].name, &X, &N);
+      bn256_add_uint (&X, &N, 1);
+      failures += check (modulus[m].name, &X, &N);
+      memset (&X, 0xff, sizeof (bn256));
+      failures += check (modulus[m].name, &X, &N);
+      bn256_sub_uint (&X, &X, 1);
+      failures += check (modulus[m].name, &X, &N);
+
+      for (i = 0; i < 10000; i++)
+	{
+	  for (j = 0; j < BN256_WORDS; j++)
+	    X.word[j] = rnd ();
+
+	  /* Sometimes, small number, or a number near 2^256.  */
+	  if (i % 16 == 1)
+	    memset (&X.word[1], 0, sizeof (uint32_t) * (BN256_WORDS - 1));
+	  else if (i % 16 == 2)
+	    memset (&X.word[1], 0xff, sizeof (uint32_t) * (BN256_WORDS - 1));
+
+	  failures += check (modulus[m].name, &X, &N);
+	}
+    }
+
+  if (failures)
+    return 1;
+
+  printf ("modular inversion: OK\n");
+  return 0;
+}
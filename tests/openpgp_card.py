@@ -215,6 +215,25 @@ class OpenPGP_Card(object):
             raise ValueError("%02x%02x" % (sw[0], sw[1]))
         return True
 
+    def cmd_get_data_extended(self, tagh, tagl):
+        # Case 2E: extended Le (0x0000 = maximum), full response at once
+        cmd_data = pack('>BBBBBH', 0x00, 0xca, tagh, tagl, 0, 0)
+        sw = self.__reader.send_cmd(cmd_data)
+        if len(sw) < 2:
+            raise ValueError(sw)
+        if sw[-2] == 0x90 and sw[-1] == 0x00:
+            return sw[0:-2]
+        if sw[0] == 0x6a and sw[1] == 0x88:
+            return None
+        else:
+            raise ValueError("%02x%02x" % (sw[0], sw[1]))
+
+    def cmd_get_data_pipelined(self, tagh0, tagl0, tagh1, tagl1):
+        # Second command is sent while the first one is executed
+        cmd0 = iso7816_compose(0xca, tagh0, tagl0, b"", le=254)
+        cmd1 = iso7816_compose(0xca, tagh1, tagl1, b"", le=254)
+        return self.__reader.ccid_send_data_block_pipelined(cmd0, cmd1)
+
     def cmd_get_data(self, tagh, tagl):
         cmd_data = iso7816_compose(0xca, tagh, tagl, b"", le=254)
         sw = self.__reader.send_cmd(cmd_data)
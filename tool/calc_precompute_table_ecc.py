@@ -1,28 +1,114 @@
-from ecdsa import curves, ecdsa
-G = ecdsa.generator_secp256k1
-# G = ecdsa.generator_256
-
-def print_nG(n):
-   nG = n*G
-   nGx_str = "%064x" % nG.x()
-   nGy_str = "%064x" % nG.y()
-   print256(nGx_str)
-   print256(nGy_str)
-   print()
-
-def print256(s):
-   print("0x%s, 0x%s, 0x%s, 0x%s," % (s[56:64], s[48:56], s[40:48], s[32:40]))
-   print("0x%s, 0x%s, 0x%s, 0x%s" %  (s[24:32], s[16:24], s[8:16], s[0:8]))
-   print()
-
-
-for i in range(1,16):
-  n = (i & 1) + (i & 2) * 0x8000000000000000 + (i & 4) * 0x40000000000000000000000000000000 + (i & 8) * 0x200000000000000000000000000000000000000000000000
-  print("%064x" % n)
-  print_nG(n)
-
-for i in range(1,16):
-  n = (i & 1) + (i & 2) * 0x8000000000000000 + (i & 4) * 0x40000000000000000000000000000000 + (i & 8) * 0x200000000000000000000000000000000000000000000000
-  n = n * 0x100000000
-  print("%064x" % n)
-  print_nG(n)
+#! /usr/bin/python3
+
+"""
+calc_precompute_table_ecc.py - generate comb tables for compute_kG
+
+Usage: calc_precompute_table_ecc.py [--curve p256r1|p256k1] [--width W]
+
+Output is C source for src/ec_<curve>.c, the two tables
+precomputed_KG and precomputed_2E_KG for the comb method in ecc.c,
+with width W (4, 5 or 6).  For W=4, it is same to the tables in the
+source file.  For W=5 and W=6, it is used at build time to generate
+src/ec_<curve>-comb.h.
+"""
+
+import sys
+
+CURVES = {
+    'p256r1': {
+        'p':  0xffffffff00000001000000000000000000000000ffffffffffffffffffffffff,
+        'a':  -3,
+        'gx': 0x6b17d1f2e12c4247f8bce6e563a440f277037d812deb33a0f4a13945d898c296,
+        'gy': 0x4fe342e2fe1a7f9b8ee7eb4a7c0f9e162bce33576b315ececbb6406837bf51f5,
+    },
+    'p256k1': {
+        'p':  0xfffffffffffffffffffffffffffffffffffffffffffffffffffffffefffffc2f,
+        'a':  0,
+        'gx': 0x79be667ef9dcbbac55a06295ce870b07029bfcdb2dce28d959f2815b16f81798,
+        'gy': 0x483ada7726a3c4655da4fbfc0e1108a8fd17b448a68554199c47d08ffb10d4b8,
+    },
+}
+
+# Number of columns (D) for the width, so that W*D >= 256 and D is even
+COMB_D = { 4: 64, 5: 52, 6: 44 }
+
+def point_add(c, P, Q):
+    p = c['p']
+    if P is None:
+        return Q
+    if Q is None:
+        return P
+    (x1, y1) = P
+    (x2, y2) = Q
+    if x1 == x2:
+        if (y1 + y2) % p == 0:
+            return None
+        l = (3 * x1 * x1 + c['a']) * pow(2 * y1, p - 2, p) % p
+    else:
+        l = (y2 - y1) * pow(x2 - x1, p - 2, p) % p
+    x3 = (l * l - x1 - x2) % p
+    y3 = (l * (x1 - x3) - y1) % p
+    return (x3, y3)
+
+def point_mul(c, n, P):
+    R = None
+    while n:
+        if n & 1:
+            R = point_add(c, R, P)
+        P = point_add(c, P, P)
+        n >>= 1
+    return R
+
+def print256(s, last):
+    print("    {{{ 0x%s, 0x%s, 0x%s, 0x%s," % (s[56:64], s[48:56], s[40:48], s[32:40]))
+    print("\t0x%s, 0x%s, 0x%s, 0x%s }}}%s" % (s[24:32], s[16:24], s[8:16], s[0:8],
+                                            "" if last else ","))
+
+def print_table(c, name, w, shift):
+    d = COMB_D[w]
+    G = (c['gx'], c['gy'])
+    num = (1 << w) - 1
+    print("static const ac %s[%d] = {" % (name, num))
+    for i in range(1, num + 1):
+        n = 0
+        for r in range(w):
+            if i & (1 << r):
+                n += 1 << (r * d)
+        (x, y) = point_mul(c, n << shift, G)
+        print("  {" if i == 1 else "  }, {")
+        print256("%064x" % x, False)
+        print256("%064x" % y, True)
+    print("  }")
+    print("};")
+
+def main(curve, w):
+    c = CURVES[curve]
+    e = COMB_D[w] // 2
+    if w != 4:
+        print("/* Generated by tool/calc_precompute_table_ecc.py.  */")
+        print("#if ECC_COMB_WIDTH != %d" % w)
+        print("#error \"Table width mismatch\"")
+        print("#endif")
+        print()
+    print_table(c, "precomputed_KG", w, 0)
+    print()
+    print_table(c, "precomputed_2E_KG", w, e)
+    return 0
+
+if __name__ == '__main__':
+    curve = 'p256r1'
+    w = 4
+    while len(sys.argv) > 1:
+        option = sys.argv[1]
+        sys.argv.pop(1)
+        if option == '--curve':
+            curve = sys.argv[1]
+            sys.argv.pop(1)
+        elif option == '--width':
+            w = int(sys.argv[1])
+            sys.argv.pop(1)
+        else:
+            raise ValueError("unknown option", option)
+    if curve not in CURVES or w not in COMB_D:
+        raise ValueError("unsupported curve or width", curve, w)
+    sys.exit(main(curve, w))
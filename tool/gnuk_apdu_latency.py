@@ -0,0 +1,96 @@
+#! /usr/bin/python3
+
+"""
+gnuk_apdu_latency.py - a tool to measure worst-case APDU latency
+
+This file is a part of Gnuk, a GnuPG USB Token implementation.
+
+Gnuk is free software: you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Gnuk is distributed in the hope that it will be useful, but WITHOUT
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+"""
+
+import sys, time, os
+
+from gnuk_token import get_gnuk_device
+
+DEFAULT_PW1 = "123456"
+DEFAULT_PW3 = "12345678"
+
+ALGO_ATTR_RSA2K = b'\x01\x08\x00\x00\x20\x00'
+ALGO_ATTR_ECDSA_P256R1 = b'\x13\x2a\x86\x48\xce\x3d\x03\x01\x07'
+
+KEYNO_SIG = 1
+
+# Each PSO:CDS increments the digital signature counter, which is
+# written to the flash data pool.  Once in a while, the data pool
+# gets full and a command is delayed by copying GC and page erase.
+# This tool reports the latency of the slowest PSO:CDS, to see such
+# a stall.  With "-s SEC", it sleeps SEC seconds after every 100
+# signatures, so that the token can do its flash work when idle
+# (SEC should be longer than the CCID timeout of 2 seconds).
+#
+# Note that this overwrites the signing key.  Use it with the
+# GNU/Linux emulation, or a token for testing.
+
+def main(count, sleep_sec, pw1, pw3):
+    gnuk = get_gnuk_device()
+    gnuk.cmd_select_openpgp()
+    gnuk.cmd_verify(3, pw3.encode('UTF-8'))
+    gnuk.cmd_put_data(0x00, 0xc0 + KEYNO_SIG, ALGO_ATTR_ECDSA_P256R1)
+    gnuk.cmd_genkey(KEYNO_SIG)
+    times = []
+    for i in range(count):
+        if sleep_sec and i > 0 and i % 100 == 0:
+            time.sleep(sleep_sec)
+        gnuk.cmd_verify(1, pw1.encode('UTF-8'))
+        digest = os.urandom(32)
+        t0 = time.time()
+        gnuk.cmd_pso(0x9e, 0x9a, digest)
+        t = time.time() - t0
+        times.append(t)
+    times.sort()
+    mean = sum(times) / count
+    median = times[count // 2]
+    p99 = times[min(count - 1, (count * 99) // 100)]
+    stalls = len([t for t in times if t > median * 2])
+    print("PSO:CDS: %d runs, mean %.2f msec, p99 %.2f msec, max %.2f msec"
+          % (count, mean * 1000, p99 * 1000, times[-1] * 1000))
+    print("%d runs took more than twice the median (%.2f msec)"
+          % (stalls, median * 1000))
+    # Leave the token with RSA-2048 attribute, which is default
+    gnuk.cmd_put_data(0x00, 0xc0 + KEYNO_SIG, ALGO_ATTR_RSA2K)
+    return 0
+
+if __name__ == '__main__':
+    count = 1000
+    sleep_sec = 0
+    pw1 = DEFAULT_PW1
+    pw3 = DEFAULT_PW3
+    while len(sys.argv) > 1:
+        option = sys.argv[1]
+        sys.argv.pop(1)
+        if option == '-n':
+            count = int(sys.argv[1])
+            sys.argv.pop(1)
+        elif option == '-s':
+            sleep_sec = float(sys.argv[1])
+            sys.argv.pop(1)
+        elif option == '-p':
+            pw1 = sys.argv[1]
+            sys.argv.pop(1)
+        elif option == '-P':
+            pw3 = sys.argv[1]
+            sys.argv.pop(1)
+        else:
+            raise ValueError("unknown option", option)
+    main(count, sleep_sec, pw1, pw3)
@@ -0,0 +1,103 @@
+#! /usr/bin/python3
+
+"""
+gnuk_apdu_replay_bench.py - a tool to replay an APDU trace and measure
+
+This file is a part of Gnuk, a GnuPG USB Token implementation.
+
+Gnuk is free software: you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Gnuk is distributed in the hope that it will be useful, but WITHOUT
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+"""
+
+import sys, time
+from binascii import unhexlify
+
+from gnuk_token import get_gnuk_device
+
+# Default trace: what scdaemon sends for "gpg --card-status" (no
+# PIN, no key needed), and an unsupported INS.  A trace file has an
+# APDU in hex for each line, '#' for comment line.
+#
+# Most of the time is for USB transactions, but the difference of
+# the APDU dispatcher (process_command_apdu) of builds can be seen
+# with the GNU/Linux emulation, with large number of runs.
+
+DEFAULT_TRACE = [
+    "00a4040006d27600012401",   # SELECT OpenPGP application
+    "00ca004f00",               # GET DATA: AID
+    "00ca5f5200",               # GET DATA: Historical bytes
+    "00ca006e00",               # GET DATA: Application related data
+    "00ca006500",               # GET DATA: Cardholder related data
+    "00ca5f5000",               # GET DATA: URL
+    "00ca007a00",               # GET DATA: Security support template
+    "00ca00c400",               # GET DATA: PW status bytes
+    "0084000008",               # GET CHALLENGE
+    "00fe000000",               # Unsupported INS
+]
+
+def read_trace(filename):
+    trace = []
+    with open(filename) as f:
+        for line in f:
+            line = line.strip()
+            if line == "" or line[0] == '#':
+                continue
+            trace.append(line.split()[0])
+    return trace
+
+def replay(gnuk, apdu):
+    n = 1
+    r = gnuk.icc_send_cmd(apdu)
+    while len(r) >= 2 and r[-2] == 0x61:
+        r = gnuk.icc_send_cmd(b'\x00\xc0\x00\x00' + bytes([r[-1]]))
+        n += 1
+    return n
+
+def main(count, trace):
+    apdus = [ unhexlify(a) for a in trace ]
+    gnuk = get_gnuk_device()
+    gnuk.cmd_select_openpgp()
+    times = {}
+    total = 0
+    t0 = time.time()
+    for i in range(count):
+        for apdu in apdus:
+            t1 = time.time()
+            total += replay(gnuk, apdu)
+            t = time.time() - t1
+            ins = apdu[1]
+            times[ins] = times.get(ins, 0) + t
+    t = time.time() - t0
+    print("replay: %d runs of %d APDUs, %d APDUs (with GET RESPONSE), "
+          "%.3f sec, %.0f APDUs/sec"
+          % (count, len(apdus), total, t, total / t))
+    for ins in sorted(times):
+        n = sum(1 for a in apdus if a[1] == ins) * count
+        print("  INS %02x: mean %.3f msec" % (ins, times[ins] * 1000 / n))
+    return 0
+
+if __name__ == '__main__':
+    count = 100
+    trace = DEFAULT_TRACE
+    while len(sys.argv) > 1:
+        option = sys.argv[1]
+        sys.argv.pop(1)
+        if option == '-n':
+            count = int(sys.argv[1])
+            sys.argv.pop(1)
+        elif option == '-t':
+            trace = read_trace(sys.argv[1])
+            sys.argv.pop(1)
+        else:
+            raise ValueError("unknown option", option)
+    main(count, trace)
@@ -0,0 +1,98 @@
+#! /usr/bin/python3
+
+"""
+gnuk_ecdh_bench.py - a tool to measure on-card ECDH time
+
+This file is a part of Gnuk, a GnuPG USB Token implementation.
+
+Gnuk is free software: you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Gnuk is distributed in the hope that it will be useful, but WITHOUT
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+"""
+
+import sys, time, random
+
+from gnuk_token import get_gnuk_device
+from calc_precompute_table_ecc import CURVES, point_mul
+
+DEFAULT_PW1 = "123456"
+DEFAULT_PW3 = "12345678"
+
+ALGO_ATTR_RSA2K = b'\x01\x08\x00\x00\x20\x00'
+ALGO_ATTR_ECDH = {
+    'p256r1': b'\x12\x2a\x86\x48\xce\x3d\x03\x01\x07',
+    'p256k1': b'\x12\x2b\x81\x04\x00\x0a',
+}
+
+KEYNO_DEC = 2
+
+# Each PSO:DECIPHER runs a variable-base scalar multiplication
+# (compute_kP) with the decryption key, for a point of random peer.
+# To compare implementations of compute_kP, build the emulation (or
+# the firmware) with each, and run this tool with same options.
+#
+# Note that this overwrites the decryption key.  Use it with the
+# GNU/Linux emulation, or a token for testing.
+
+def ecdh_cipher_do(curve):
+    c = CURVES[curve]
+    k = random.randrange(1, c['p'])
+    (x, y) = point_mul(c, k, (c['gx'], c['gy']))
+    point = b'\x04' + x.to_bytes(32, 'big') + y.to_bytes(32, 'big')
+    # A6 (Cipher DO) { 7F49 (Public key DO) { 86 (External public key) } }
+    return b'\xa6\x46\x7f\x49\x43\x86\x41' + point
+
+def main(count, curve, pw1, pw3):
+    gnuk = get_gnuk_device()
+    gnuk.cmd_select_openpgp()
+    gnuk.cmd_verify(3, pw3.encode('UTF-8'))
+    gnuk.cmd_put_data(0x00, 0xc0 + KEYNO_DEC, ALGO_ATTR_ECDH[curve])
+    gnuk.cmd_genkey(KEYNO_DEC)
+    gnuk.cmd_verify(2, pw1.encode('UTF-8'))
+    data = [ ecdh_cipher_do(curve) for i in range(count) ]
+    times = []
+    for i in range(count):
+        t0 = time.time()
+        gnuk.cmd_pso(0x80, 0x86, data[i])
+        t = time.time() - t0
+        times.append(t)
+    times.sort()
+    mean = sum(times) / count
+    p95 = times[min(count - 1, (count * 95) // 100)]
+    print("ECDH %s: %d runs, mean %.2f msec, p95 %.2f msec, min %.2f msec"
+          % (curve, count, mean * 1000, p95 * 1000, times[0] * 1000))
+    # Leave the token with RSA-2048 attribute, which is default
+    gnuk.cmd_put_data(0x00, 0xc0 + KEYNO_DEC, ALGO_ATTR_RSA2K)
+    return 0
+
+if __name__ == '__main__':
+    count = 100
+    curve = 'p256r1'
+    pw1 = DEFAULT_PW1
+    pw3 = DEFAULT_PW3
+    while len(sys.argv) > 1:
+        option = sys.argv[1]
+        sys.argv.pop(1)
+        if option == '--secp256k1':
+            curve = 'p256k1'
+        elif option == '-n':
+            count = int(sys.argv[1])
+            sys.argv.pop(1)
+        elif option == '-p':
+            pw1 = sys.argv[1]
+            sys.argv.pop(1)
+        elif option == '-P':
+            pw3 = sys.argv[1]
+            sys.argv.pop(1)
+        else:
+            raise ValueError("unknown option", option)
+    main(count, curve, pw1, pw3)
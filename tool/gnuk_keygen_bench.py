@@ -0,0 +1,79 @@
+#! /usr/bin/python3
+
+"""
+gnuk_keygen_bench.py - a tool to measure on-card RSA key generation time
+
+This file is a part of Gnuk, a GnuPG USB Token implementation.
+
+Gnuk is free software: you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Gnuk is distributed in the hope that it will be useful, but WITHOUT
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+"""
+
+import sys, time
+
+from gnuk_token import get_gnuk_device
+
+DEFAULT_PW3 = "12345678"
+
+ALGO_ATTR_RSA2K = b'\x01\x08\x00\x00\x20\x00'
+ALGO_ATTR_RSA4K = b'\x01\x10\x00\x00\x20\x00'
+
+# Key generation consumes fresh random bits from the token each time,
+# so each run is a different seed for the prime search.
+#
+# Note that this overwrites the key in the slot (default: authentication).
+# Use it with the GNU/Linux emulation, or a token for testing.
+
+def main(count, keyno, attr, passwd):
+    gnuk = get_gnuk_device()
+    gnuk.cmd_select_openpgp()
+    gnuk.cmd_verify(3, passwd.encode('UTF-8'))
+    gnuk.cmd_put_data(0x00, 0xc0 + keyno, attr)
+    times = []
+    for i in range(count):
+        t0 = time.time()
+        gnuk.cmd_genkey(keyno)
+        t = time.time() - t0
+        times.append(t)
+        print("%d: %.3f sec" % (i, t))
+    times.sort()
+    mean = sum(times) / count
+    p95 = times[min(count - 1, (count * 95) // 100)]
+    print("keygen: %d runs, mean %.3f sec, p95 %.3f sec, max %.3f sec"
+          % (count, mean, p95, times[-1]))
+    # Leave the token with RSA-2048 attribute, which is default
+    gnuk.cmd_put_data(0x00, 0xc0 + keyno, ALGO_ATTR_RSA2K)
+    return 0
+
+if __name__ == '__main__':
+    count = 20
+    keyno = 3                   # Authentication key
+    attr = ALGO_ATTR_RSA2K
+    passwd = DEFAULT_PW3
+    while len(sys.argv) > 1:
+        option = sys.argv[1]
+        sys.argv.pop(1)
+        if option == '--rsa4096':
+            attr = ALGO_ATTR_RSA4K
+        elif option == '-n':
+            count = int(sys.argv[1])
+            sys.argv.pop(1)
+        elif option == '-k':
+            keyno = int(sys.argv[1])
+            sys.argv.pop(1)
+        elif option == '-p':
+            passwd = sys.argv[1]
+            sys.argv.pop(1)
+        else:
+            raise ValueError("unknown option", option)
+    main(count, keyno, attr, passwd)
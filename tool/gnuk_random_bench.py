@@ -0,0 +1,86 @@
+#! /usr/bin/python3
+
+"""
+gnuk_random_bench.py - a tool to measure throughput of on-card random bytes
+
+This file is a part of Gnuk, a GnuPG USB Token implementation.
+
+Gnuk is free software: you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Gnuk is distributed in the hope that it will be useful, but WITHOUT
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+"""
+
+import sys, time
+
+from gnuk_token import get_gnuk_device
+
+# Random bytes from the token are generated by the DRBG of random.c
+# (the same generate function is used by random_gen for RSA key
+# generation).  GET CHALLENGE is the way to get them from host, so,
+# this measures its throughput in bytes/second, including the USB
+# transaction overhead.
+#
+# With --neug, --raw or --raw-data, it measures streaming of NeuG
+# output by GET CHALLENGE with P1 (Gnuk specific), LENGTH bytes for
+# each APDU.  LENGTH > 256 uses extended Le.  With -o FILE, the bytes are written to FILE.
+#
+# To compare implementations, run this tool with the firmware (or the
+# GNU/Linux emulation) built with each.
+
+def main(count, p1, length, output):
+    gnuk = get_gnuk_device()
+    gnuk.cmd_select_openpgp()
+    total = 0
+    t0 = time.time()
+    for i in range(count):
+        if p1 == 0:
+            data = gnuk.cmd_get_challenge()
+        else:
+            data = gnuk.cmd_get_challenge_stream(p1, length)
+        total += len(data)
+        if output:
+            output.write(bytes(data))
+    t = time.time() - t0
+    print("GET CHALLENGE (P1=%d): %d runs, %d bytes, %.3f sec, %.0f bytes/sec"
+          % (p1, count, total, t, total / t))
+    return 0
+
+if __name__ == '__main__':
+    count = 1000
+    p1 = 0
+    length = 256
+    output = None
+    while len(sys.argv) > 1:
+        option = sys.argv[1]
+        sys.argv.pop(1)
+        if option == '--neug':
+            p1 = 1
+        elif option == '--raw':
+            p1 = 2
+        elif option == '--raw-data':
+            p1 = 3
+        elif option == '-n':
+            count = int(sys.argv[1])
+            sys.argv.pop(1)
+        elif option == '-l':
+            length = int(sys.argv[1])
+            sys.argv.pop(1)
+        elif option == '-o':
+            output = open(sys.argv[1], 'wb')
+            sys.argv.pop(1)
+        else:
+            raise ValueError("unknown option", option)
+    if length < 1 or length > 526:
+        raise ValueError("length should be 1..526", length)
+    main(count, p1, length, output)
+    if output:
+        output.close()
@@ -488,6 +488,21 @@ class gnuk_token(object):
             raise ValueError("%02x%02x" % (sw[0], sw[1]))
         return self.cmd_get_response(sw[1])
 
+    def cmd_get_challenge_stream(self, p1, length):
+        # Gnuk specific: P1=1 conditioned, 2 raw, 3 raw data of NeuG
+        if length <= 256:
+            cmd_data = iso7816_compose(0x84, p1, 0x00, b'') + pack('>B', length & 0xff)
+        else:
+            # Extended Le
+            cmd_data = iso7816_compose(0x84, p1, 0x00, b'') + pack('>BH', 0, length)
+        response = self.icc_send_cmd(cmd_data)
+        sw = response[-2:]
+        if sw[0] == 0x90 and sw[1] == 0x00:
+            return response[:-2]
+        elif sw[0] != 0x61:
+            raise ValueError("%02x%02x" % (sw[0], sw[1]))
+        return response[:-2] + self.cmd_get_response(sw[1])
+
     def cmd_external_authenticate(self, keyno, signed):
         cmd_data = iso7816_compose(0x82, 0x00, keyno, signed[0:128], cls=0x10)
         sw = self.icc_send_cmd(cmd_data)